@@ -1,9 +1,22 @@
 #include <iostream>
 #include <gmp.h>
 #include <ctime>
+#include <chrono>
+#include <thread>
 
 #include "paillier.h"
 #include "soci.h"
+#include "index.h"
+#include "scan.h"
+#include "ingest.h"
+#include "precomp.h"
+#include "knn.h"
+#include "share.h"
+#include "fbcache.h"
+#include "window.h"
+#include "groupby.h"
+#include "nn.h"
+#include "autotune.h"
 
 using namespace std;
 using namespace phe;
@@ -11,8 +24,451 @@ using namespace soci;
 
 #define KEY_LEN_BIT 512
 #define SIGMA_LEN_BIT 128
+#define DJ_S 1
+
+/*
+* soci keygen <bits> <key prefix> [s]
+* writes the public key to <key prefix>.pub and the private key to <key prefix>.key
+*/
+int run_keygen(int argc, char *argv[]) {
+	if (argc < 4) {
+		printf("usage: soci keygen <bits> <key prefix> [s]\n");
+		return 1;
+	}
+	setrandom();
+	seed_random();
+	Paillier pai;
+	pai.keygen(atoi(argv[2]), argc > 4 ? atoi(argv[4]) : 1);
+	string prefix = argv[3];
+	if (!save_pubkey((prefix + ".pub").c_str(), pai.pubkey) || !save_prikey((prefix + ".key").c_str(), pai.prikey)) {
+		printf("cannot write %s.pub / %s.key\n", argv[3], argv[3]);
+		return 1;
+	}
+	return 0;
+}
+
+/*
+* soci ingest <public key> <input|-> <output prefix> [threads] [--raw]
+* encrypts a CSV file (or a raw integer stream with --raw) into <output prefix>.col<j>
+*/
+int run_ingest(int argc, char *argv[]) {
+	bool raw = false;
+	int threads = 0;
+	vector<char *> args;
+	for (int i = 2; i < argc; i++) {
+		if (strcmp(argv[i], "--raw") == 0) {
+			raw = true;
+		}
+		else {
+			args.push_back(argv[i]);
+		}
+	}
+	if (args.size() < 3) {
+		printf("usage: soci ingest <public key> <input|-> <output prefix> [threads] [--raw]\n");
+		return 1;
+	}
+	if (args.size() > 3) {
+		threads = atoi(args[3]);
+	}
+	setrandom();
+	seed_random();
+	PaillierKey pk;
+	if (!load_pubkey(args[0], pk)) {
+		printf("cannot read public key %s\n", args[0]);
+		return 1;
+	}
+	ingest ing(pk, threads, 0, raw);
+	struct timespec t0, t1;
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	bool ok = ing.run(args[1], args[2]);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	double sec = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+	if (!ok) {
+		printf("ingest failed: %s\n", ing.error.c_str());
+		return 1;
+	}
+	printf("encrypted %ld values (%ld rows) with %d threads in %f s, %f values/s\n",
+		ing.values, ing.rows, ing.threads, sec, ing.values / sec);
+	return 0;
+}
+
+/*
+* soci decrypt <private key> <column file> [count]
+* prints the first count (default all) plaintexts of a ciphertext column file
+*/
+int run_decrypt(int argc, char *argv[]) {
+	if (argc < 4) {
+		printf("usage: soci decrypt <private key> <column file> [count]\n");
+		return 1;
+	}
+	PaillierPrivateKey sk;
+	if (!load_prikey(argv[2], sk)) {
+		printf("cannot read private key %s\n", argv[2]);
+		return 1;
+	}
+	Paillier pai(sk);
+	FILE *fp = fopen(argv[3], "rb");
+	if (fp == NULL) {
+		printf("cannot open %s\n", argv[3]);
+		return 1;
+	}
+	long count = argc > 4 ? atol(argv[4]) : -1;
+	size_t bytes = cipher_bytes(pai.pubkey);
+	vector<unsigned char> buf(bytes);
+	mpz_t c, m;
+	mpz_inits(c, m, NULL);
+	for (long i = 0; i != count && fread(buf.data(), 1, bytes, fp) == bytes; i++) {
+		get_cipher(c, buf.data(), bytes);
+		pai.decrypt(m, c);
+		if (mpz_cmp(m, pai.pubkey.half_n) > 0) {
+			mpz_sub(m, m, pai.pubkey.ns);
+		}
+		gmp_printf("%Zd\n", m);
+	}
+	mpz_clears(c, m, NULL);
+	fclose(fp);
+	return 0;
+}
+
+/*
+* soci tune [bits]
+* benchmarks the kernels with a bits-bit key (default KEY_LEN_BIT) and writes
+* the chosen configuration to $SOCI_TUNE_FILE, or ./soci.conf if it is unset
+*/
+int run_tune(int argc, char *argv[]) {
+	setrandom();
+	seed_random();
+	int bits = argc > 2 ? atoi(argv[2]) : KEY_LEN_BIT;
+	tune_config cfg = tune(bits, stdout);
+	if (!save_tune(tune_file(), cfg)) {
+		printf("cannot write %s\n", tune_file());
+		return 1;
+	}
+	printf("threads %d, chunk %d, batch %d, fbcache window %d, dense window %d written to %s\n",
+		cfg.threads, cfg.chunk, cfg.batch, cfg.fb_window, cfg.nn_window, tune_file());
+	return 0;
+}
+
+double seconds_since(struct timespec &t0) {
+	struct timespec t1;
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	return (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+}
+
+/*
+* soci knn [n] [dim] [k]
+* benchmarks a k-nearest-neighbour query over n random dim-dimensional
+* vectors with 8-bit coordinates (default 32 x 8, k = 4). The query costs
+* n*dim smul plus O(n log^2 k) compare-exchanges of one scmp and up to three
+* smul each, about 11 s for the default on one core with KEY_LEN_BIT = 512
+*/
+int run_knn(int argc, char *argv[]) {
+	int n = argc > 2 ? atoi(argv[2]) : 32;
+	int dim = argc > 3 ? atoi(argv[3]) : 8;
+	int k = argc > 4 ? atoi(argv[4]) : 4;
+	if (n < 1 || dim < 1 || k < 1 || k > n) {
+		printf("usage: soci knn [n] [dim] [k], 1 <= k <= n\n");
+		return 1;
+	}
+	setrandom();
+	seed_random();
+	Paillier pai;
+	pai.keygen(KEY_LEN_BIT, DJ_S);
+	PaillierThd cp, csp;
+	ThirdKeyGen tkg;
+	tkg.thdkeygen(pai, SIGMA_LEN_BIT, &cp, &csp);
+
+	vector<long> plain((long)n * dim + dim);
+	for (auto &v : plain) {
+		v = rand() % 256;
+	}
+	mpz_t *points = new mpz_t[(long)n * dim + dim];
+	struct timespec t0;
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	parallel_for((long)n * dim + dim, [&](long i) {
+		mpz_init_set_si(points[i], plain[i]);
+		pai.encrypt(points[i], points[i]);
+	});
+	printf("encrypted %d x %d points and the query in %f s\n", n, dim, seconds_since(t0));
+
+	knn kn(points, NULL, n, dim, cp, csp);
+	mpz_t *eq = points + (long)n * dim;
+	mpz_t *elabel = new mpz_t[k], *edist = new mpz_t[k];
+	for (int t = 0; t < k; t++) {
+		mpz_inits(elabel[t], edist[t], NULL);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	kn.query(elabel, edist, eq, k);
+	printf("kNN query with %d threads in %f s\n", get_num_threads(), seconds_since(t0));
+
+	// check against the plaintext ranking, ties broken by index
+	vector<pair<long, int>> dist(n);
+	for (int i = 0; i < n; i++) {
+		long d = 0;
+		for (int j = 0; j < dim; j++) {
+			long diff = plain[(long)i * dim + j] - plain[(long)n * dim + j];
+			d += diff * diff;
+		}
+		dist[i] = make_pair(d, i);
+	}
+	partial_sort(dist.begin(), dist.begin() + k, dist.end());
+	mpz_t m;
+	mpz_init(m);
+	bool ok = true;
+	for (int t = 0; t < k; t++) {
+		pai.decrypt(m, elabel[t]);
+		long idx = mpz_get_si(m);
+		pai.decrypt(m, edist[t]);
+		printf("%d: index %ld, distance %ld\n", t, idx, mpz_get_si(m));
+		ok = ok && idx == dist[t].second && mpz_get_si(m) == dist[t].first;
+	}
+	printf(ok ? "result matches the plaintext kNN\n" : "result does NOT match the plaintext kNN\n");
+
+	mpz_clear(m);
+	for (int t = 0; t < k; t++) {
+		mpz_clears(elabel[t], edist[t], NULL);
+	}
+	for (long i = 0; i < (long)n * dim + dim; i++) {
+		mpz_clear(points[i]);
+	}
+	delete[] elabel;
+	delete[] edist;
+	delete[] points;
+	return ok ? 0 : 1;
+}
+
+/*
+* soci comm [n] [ell] [bits]
+* reports the CP<->CSP traffic of n batched smul and scmp against their
+* packed variants for ell-bit signed inputs (default 1000, 32, KEY_LEN_BIT)
+*/
+int run_comm(int argc, char *argv[]) {
+	int n = argc > 2 ? atoi(argv[2]) : 1000;
+	int ell = argc > 3 ? atoi(argv[3]) : 32;
+	int bits = argc > 4 ? atoi(argv[4]) : KEY_LEN_BIT;
+	if (n < 1 || ell < 1 || ell > 62) {
+		printf("usage: soci comm [n] [ell] [bits], 1 <= ell <= 62\n");
+		return 1;
+	}
+	setrandom();
+	seed_random();
+	Paillier pai;
+	pai.keygen(bits, DJ_S);
+	PaillierThd cp, csp;
+	ThirdKeyGen tkg;
+	tkg.thdkeygen(pai, SIGMA_LEN_BIT, &cp, &csp);
+
+	vector<long> px(n), py(n);
+	mpz_t *ex = new mpz_t[n], *ey = new mpz_t[n], *res = new mpz_t[n];
+	long half = 1L << (ell - 1);
+	for (int i = 0; i < n; i++) {
+		px[i] = (long)(((unsigned long)rand() << 31 | rand()) % (2 * half)) - half;
+		py[i] = (long)(((unsigned long)rand() << 31 | rand()) % (2 * half)) - half;
+	}
+	parallel_for(n, [&](long i) {
+		mpz_inits(ex[i], ey[i], res[i], NULL);
+		mpz_set_si(ex[i], px[i]);
+		mpz_mod(ex[i], ex[i], pai.pubkey.ns);
+		pai.encrypt(ex[i], ex[i]);
+		mpz_set_si(ey[i], py[i]);
+		mpz_mod(ey[i], ey[i], pai.pubkey.ns);
+		pai.encrypt(ey[i], ey[i]);
+	});
+
+	seccomp sc;
+	comm_stats cs;
+	sc.comm = &cs;
+	mpz_t m, want;
+	mpz_inits(m, want, NULL);
+	bool ok = true;
+	struct timespec t0;
+	for (int v = 0; v < 4; v++) {
+		const char *name[4] = { "smul", "smul_packed", "scmp", "scmp_packed" };
+		clock_gettime(CLOCK_MONOTONIC, &t0);
+		if (v == 0) sc.smul(res, ex, ey, n, cp, csp);
+		else if (v == 1) sc.smul_packed(res, ex, ey, n, ell, cp, csp);
+		else if (v == 2) sc.scmp(res, ex, ey, n, cp, csp);
+		else sc.scmp_packed(res, ex, ey, n, ell, cp, csp);
+		printf("%s: %d ops in %f s\n", name[v], n, seconds_since(t0));
+		for (int i = 0; i < n; i++) {
+			pai.decrypt(m, res[i]);
+			if (v < 2) {
+				mpz_set_si(want, px[i]);
+				mpz_mul_si(want, want, py[i]);
+				mpz_mod(want, want, pai.pubkey.ns);
+			}
+			else {
+				mpz_set_ui(want, px[i] < py[i]);
+			}
+			ok = ok && mpz_cmp(m, want) == 0;
+		}
+	}
+	cs.report(stdout);
+	printf(ok ? "all results are correct\n" : "some results are NOT correct\n");
+
+	mpz_clears(m, want, NULL);
+	for (int i = 0; i < n; i++) {
+		mpz_clears(ex[i], ey[i], res[i], NULL);
+	}
+	delete[] ex;
+	delete[] ey;
+	delete[] res;
+	return ok ? 0 : 1;
+}
+
+/*
+* soci mlp [batch] [sizes...]
+* benchmarks encrypted inference of a random fixed-point MLP with the
+* layer sizes given (default 4 inputs through 64 32 10), ReLU between
+* layers, and checks the outputs against the plaintext network
+*/
+int run_mlp(int argc, char *argv[]) {
+	const int frac = 6, ell = 48;      // fixed-point fraction bits, bound on the pre-activations
+	int batch = argc > 2 ? atoi(argv[2]) : 4;
+	vector<int> sizes;
+	for (int i = 3; i < argc; i++) {
+		sizes.push_back(atoi(argv[i]));
+	}
+	if (sizes.empty()) {
+		sizes = { 64, 32, 10 };
+	}
+	bool valid = batch >= 1 && sizes.size() >= 2;
+	for (int s : sizes) {
+		valid = valid && s >= 1;
+	}
+	if (!valid) {
+		printf("usage: soci mlp [batch] [sizes...], at least two layer sizes\n");
+		return 1;
+	}
+	setrandom();
+	seed_random();
+	Paillier pai;
+	pai.keygen(KEY_LEN_BIT, DJ_S);
+	PaillierThd cp, csp;
+	ThirdKeyGen tkg;
+	tkg.thdkeygen(pai, SIGMA_LEN_BIT, &cp, &csp);
+
+	// weights in [-1, 1] and inputs in [-1, 1) with frac fraction bits, biases at 2*frac
+	int layers = sizes.size() - 1;
+	vector<vector<long>> w(layers), b(layers);
+	for (int l = 0; l < layers; l++) {
+		w[l].resize((long)sizes[l] * sizes[l + 1]);
+		b[l].resize(sizes[l + 1]);
+		for (auto &v : w[l]) {
+			v = rand() % (2 * (1 << frac) + 1) - (1 << frac);
+		}
+		for (auto &v : b[l]) {
+			v = rand() % (2 * (1 << (2 * frac)) + 1) - (1 << (2 * frac));
+		}
+	}
+	vector<long> plain((long)batch * sizes[0]);
+	for (auto &v : plain) {
+		v = rand() % (2 * (1 << frac)) - (1 << frac);
+	}
+
+	int width = *max_element(sizes.begin(), sizes.end());
+	mpz_t *cur = new mpz_t[(long)batch * width], *nxt = new mpz_t[(long)batch * width];
+	for (long i = 0; i < (long)batch * width; i++) {
+		mpz_inits(cur[i], nxt[i], NULL);
+	}
+	struct timespec t0, t1;
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	parallel_for(plain.size(), [&](long i) {
+		mpz_set_si(cur[i], plain[i]);
+		mpz_mod(cur[i], cur[i], pai.pubkey.ns);
+		pai.encrypt(cur[i], cur[i]);
+	});
+	printf("encrypted %d inputs of %d values in %f s\n", batch, sizes[0], seconds_since(t0));
+
+	nn net(cp, csp);
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (int l = 0; l < layers; l++) {
+		int n = batch * sizes[l + 1];
+		clock_gettime(CLOCK_MONOTONIC, &t1);
+		net.dense(nxt, cur, batch, sizes[l], sizes[l + 1], w[l].data(), b[l].data());
+		double t_dense = seconds_since(t1);
+		clock_gettime(CLOCK_MONOTONIC, &t1);
+		if (l + 1 < layers) {
+			net.relu(nxt, nxt, n, false);              // 2*ReLU, the 2 goes into the rescale
+			net.rescale(cur, nxt, n, frac + 1, ell);
+		}
+		else {
+			net.rescale(cur, nxt, n, frac, ell);
+		}
+		printf("layer %d (%d -> %d): dense %f s, activation and rescale %f s\n", l, sizes[l], sizes[l + 1], t_dense, seconds_since(t1));
+	}
+	double total = seconds_since(t0);
+	printf("%d inferences with %d threads in %f s: latency %f s per batch, throughput %f inferences/s\n",
+		batch, get_num_threads(), total, total, batch / total);
+
+	// plaintext reference with the same floor rounding
+	auto floor_div = [](long a, long d) { return a >= 0 ? a / d : -((-a + d - 1) / d); };
+	vector<long> x = plain, y;
+	for (int l = 0; l < layers; l++) {
+		y.assign((long)batch * sizes[l + 1], 0);
+		for (int r = 0; r < batch; r++) {
+			for (int j = 0; j < sizes[l + 1]; j++) {
+				long s = b[l][j];
+				for (int i = 0; i < sizes[l]; i++) {
+					s += w[l][(long)j * sizes[l] + i] * x[(long)r * sizes[l] + i];
+				}
+				if (l + 1 < layers) {
+					s = s > 0 ? s : 0;
+				}
+				y[(long)r * sizes[l + 1] + j] = floor_div(s, 1L << frac);
+			}
+		}
+		x = y;
+	}
+	mpz_t m;
+	mpz_init(m);
+	bool ok = true;
+	for (long i = 0; i < (long)x.size(); i++) {
+		pai.decrypt(m, cur[i]);
+		if (mpz_cmp(m, pai.pubkey.half_n) > 0) {
+			mpz_sub(m, m, pai.pubkey.ns);
+		}
+		ok = ok && mpz_get_si(m) == x[i];
+	}
+	printf(ok ? "outputs match the plaintext network\n" : "outputs do NOT match the plaintext network\n");
+
+	mpz_clear(m);
+	for (long i = 0; i < (long)batch * width; i++) {
+		mpz_clears(cur[i], nxt[i], NULL);
+	}
+	delete[] cur;
+	delete[] nxt;
+	return ok ? 0 : 1;
+}
+
+int main(int argc, char *argv[]) {
+	if (argc > 1) {
+		string cmd = argv[1];
+		if (cmd == "keygen") {
+			return run_keygen(argc, argv);
+		}
+		if (cmd == "ingest") {
+			return run_ingest(argc, argv);
+		}
+		if (cmd == "decrypt") {
+			return run_decrypt(argc, argv);
+		}
+		if (cmd == "tune") {
+			return run_tune(argc, argv);
+		}
+		if (cmd == "knn") {
+			return run_knn(argc, argv);
+		}
+		if (cmd == "comm") {
+			return run_comm(argc, argv);
+		}
+		if (cmd == "mlp") {
+			return run_mlp(argc, argv);
+		}
+		printf("usage: soci [keygen | ingest | decrypt | tune | knn | comm | mlp] ...\n");
+		return 1;
+	}
 
-int main() {
 	/*
 	* start initialize.
 	*/
@@ -24,9 +480,9 @@ int main() {
 	Paillier pai;
 	/*
 	generate a PaillierTD public/private key pair pai(pk; sk)
-	with KEY_LEN_BIT length
+	with KEY_LEN_BIT length, in Damgård–Jurik mode N^(DJ_S+1) if DJ_S > 1
 	*/
-	pai.keygen(KEY_LEN_BIT);
+	pai.keygen(KEY_LEN_BIT, DJ_S);
 
 	/*
 	* splits sk into two partially private keys (sk1; sk2), 
@@ -144,6 +600,23 @@ int main() {
 	gmp_printf("s_x = %Zd u_x = %Zd\n", x, y);
 	cout << "---------------------------" << endl;
 
+	//set x
+	mpz_set_si(x, -99);
+	gmp_printf("set x = %Zd\n", x);
+	//encrypt x to cx, negative numbers are represented as N^s - |x|
+	mpz_add(x, x, pai.pubkey.ns);
+	pai.encrypt(cx, x);
+	start_time = clock();
+	//run fused ssba function, s_x, u_x are the results which are ciphertexts
+	sc.fssba(s_x, u_x, cx, cp, csp);
+	end_time = clock();
+	//decrypt s_x to x, u_x to y
+	pai.decrypt(x, s_x);
+	pai.decrypt(y, u_x);
+	printf("compute FSSBA function, its running time is  ------  %f ms\n", ((double)(end_time - start_time)) / 1 * 1000 / CLOCKS_PER_SEC);
+	gmp_printf("s_x = %Zd u_x = %Zd\n", x, y);
+	cout << "---------------------------" << endl;
+
 	//set x, y
 	mpz_set_si(x, 5429496723);
 	mpz_set_si(y, 9949672);
@@ -166,6 +639,329 @@ int main() {
 	gmp_printf("q = %Zd r = %Zd\n", x, y);
 	cout << "---------------------------" << endl;
 
+	//set x, d
+	mpz_set_si(x, 5429496723);
+	mpz_set_si(y, 9949672);
+	gmp_printf("set x = %Zd, d = %Zd\n", x, y);
+	//encrypt x to cx, d is a public constant
+	pai.encrypt(cx, x);
+	start_time = clock();
+	//run sdiv_pub function, eq is the quotient of x divided by d in ciphertext
+	sc.sdiv_pub(eq, cx, y, 40, cp, csp);
+	end_time = clock();
+	//decrypt eq to x
+	pai.decrypt(x, eq);
+	printf("compute SDIV_PUB function, its running time is  ------  %f ms\n", ((double)(end_time - start_time)) / 1 * 1000 / CLOCKS_PER_SEC);
+	gmp_printf("q = %Zd\n", x);
+	cout << "---------------------------" << endl;
+
+	//encrypt 1, 2, ..., 8
+	mpz_t factors[8];
+	for (int i = 0; i < 8; i++) {
+		mpz_init(factors[i]);
+		mpz_set_si(x, i + 1);
+		pai.encrypt(factors[i], x);
+	}
+	printf("set x_i = 1, 2, ..., 8\n");
+	start_time = clock();
+	//run sprod function, cz is the product in ciphertext, computed in 3 rounds
+	sc.sprod(cz, factors, 8, cp, csp);
+	end_time = clock();
+	//decrypt cz to z
+	pai.decrypt(z, cz);
+	printf("compute SPROD function, its running time is  ------  %f ms\n", ((double)(end_time - start_time)) / 1 * 1000 / CLOCKS_PER_SEC);
+	gmp_printf("x_1*...*x_8 = %Zd\n", z);
+	cout << "---------------------------" << endl;
+	for (int i = 0; i < 8; i++) {
+		mpz_clear(factors[i]);
+	}
+
+	//encrypt a sorted column 0, 3, 6, ..., 45
+	mpz_t keys[16];
+	for (int i = 0; i < 16; i++) {
+		mpz_init(keys[i]);
+		mpz_set_si(x, 3 * i);
+		pai.encrypt(keys[i], x);
+	}
+	CipherVector kcol(pai.pubkey);
+	for (int i = 0; i < 16; i++) {
+		kcol.push_back(keys[i]);
+	}
+	sorted_index idx(kcol, cp, csp);
+	//set lo, hi
+	mpz_set_si(x, 10);
+	mpz_set_si(y, 30);
+	gmp_printf("set lo = %Zd, hi = %Zd\n", x, y);
+	pai.encrypt(cx, x);
+	pai.encrypt(cy, y);
+	start_time = clock();
+	//run range function, eq and er are the encrypted lower and upper bounds
+	idx.range(eq, er, cx, cy);
+	end_time = clock();
+	//decrypt eq to x, er to y
+	pai.decrypt(x, eq);
+	pai.decrypt(y, er);
+	printf("compute RANGE function, its running time is  ------  %f ms\n", ((double)(end_time - start_time)) / 1 * 1000 / CLOCKS_PER_SEC);
+	gmp_printf("lb = %Zd ub = %Zd\n", x, y);
+	cout << "---------------------------" << endl;
+
+	//set a column x = 0, 3, ..., 45 (the index keys) and values v = 1, ..., 16
+	mpz_t vals[16];
+	for (int i = 0; i < 16; i++) {
+		mpz_init(vals[i]);
+		mpz_set_si(x, i + 1);
+		pai.encrypt(vals[i], x);
+	}
+	mpz_set_si(x, 20);
+	gmp_printf("set t = %Zd\n", x);
+	pai.encrypt(cx, x);
+	pscan ps(cp, csp);
+	start_time = clock();
+	//run predicate scan, SELECT SUM(v), COUNT(*) WHERE x > t
+	ps.run(eq, er, keys, vals, 16, cx, GT);
+	end_time = clock();
+	//decrypt eq to x, er to y
+	pai.decrypt(x, eq);
+	pai.decrypt(y, er);
+	printf("compute SCAN function, its running time is  ------  %f ms\n", ((double)(end_time - start_time)) / 1 * 1000 / CLOCKS_PER_SEC);
+	gmp_printf("sum = %Zd count = %Zd\n", x, y);
+	cout << "---------------------------" << endl;
+
+	//load the values into one contiguous column and sum it
+	CipherVector col(pai.pubkey);
+	for (int i = 0; i < 16; i++) {
+		col.push_back(vals[i]);
+	}
+	start_time = clock();
+	col.sum(cz, pai);
+	end_time = clock();
+	pai.decrypt(z, cz);
+	printf("compute column SUM function, its running time is  ------  %f ms\n", ((double)(end_time - start_time)) / 1 * 1000 / CLOCKS_PER_SEC);
+	gmp_printf("sum = %Zd\n", z);
+	cout << "---------------------------" << endl;
+	for (int i = 0; i < 16; i++) {
+		mpz_clear(keys[i]);
+		mpz_clear(vals[i]);
+	}
+
+	//precompute the randomness of smul, scmp and fssba offline
+	randpool pool(pai, 16, 4);
+	pool.fill();
+	sc.pool = &pool;
+	//set x, y
+	mpz_set_si(x, 99);
+	mpz_set_si(y, 789);
+	gmp_printf("set x = %Zd, y = %Zd\n", x, y);
+	pai.encrypt(cx, x);
+	pai.encrypt(cy, y);
+	start_time = clock();
+	//run smul function with a precomputed tuple
+	sc.smul(cz, cx, cy, cp, csp);
+	end_time = clock();
+	pai.decrypt(z, cz);
+	printf("compute SMUL function (precomputed), its running time is  ------  %f ms\n", ((double)(end_time - start_time)) / 1 * 1000 / CLOCKS_PER_SEC);
+	gmp_printf("x*y = %Zd\n", z);
+	//drain the smul store below low_water, the background refill tops it up before any miss
+	pool.start();
+	for (int i = 0; i < 12; i++) {
+		sc.smul(cz, cx, cy, cp, csp);
+	}
+	for (int i = 0; i < 5000 && pool.stats_smul().level < pool.capacity; i++) {
+		this_thread::sleep_for(chrono::milliseconds(1));
+	}
+	pool.stop();
+	pool_stats ps_smul = pool.stats_smul();
+	printf("smul tuples after draining to %zu: produced %ld, missed %ld, refills %ld\n",
+		ps_smul.min_level, ps_smul.produced, ps_smul.missed, ps_smul.refills);
+	sc.pool = NULL;
+	cout << "---------------------------" << endl;
+
+	//generate Beaver triples offline
+	hybrid hy(cp, csp);
+	hy.gen_triples(4);
+	ashare sx, sy, sz;
+	//set x, y
+	mpz_set_si(x, 99);
+	mpz_set_si(y, 789);
+	gmp_printf("set x = %Zd, y = %Zd\n", x, y);
+	pai.encrypt(cx, x);
+	pai.encrypt(cy, y);
+	//convert cx, cy to additive shares held by CP and CSP
+	hy.to_share(sx, cx);
+	hy.to_share(sy, cy);
+	start_time = clock();
+	//multiply the shares with a precomputed triple, no modexp
+	hy.mul(sz, sx, sy);
+	end_time = clock();
+	//convert back to a ciphertext and decrypt
+	hy.from_share(cz, sz);
+	pai.decrypt(z, cz);
+	printf("compute share MUL function, its running time is  ------  %f ms\n", ((double)(end_time - start_time)) / 1 * 1000 / CLOCKS_PER_SEC);
+	gmp_printf("x*y = %Zd\n", z);
+	cout << "---------------------------" << endl;
+
+	//cache fixed-base tables for ciphertexts that scl_mul raises to many exponents
+	fbcache fb(pai.pubkey);
+	cp.pai.cache = &fb;
+	//set x, y
+	mpz_set_si(x, 5429496723);
+	mpz_set_si(y, 9949672);
+	gmp_printf("set x = %Zd, y = %Zd\n", x, y);
+	pai.encrypt(cx, x);
+	pai.encrypt(cy, y);
+	//only cy is raised to many exponents, every other base bypasses the cache
+	fb.pin(cy);
+	start_time = clock();
+	//[y]^(2^i) is served from the table of cy
+	sc.sdiv(eq, er, cx, cy, 32, cp, csp, pai);
+	end_time = clock();
+	pai.decrypt(x, eq);
+	pai.decrypt(y, er);
+	printf("compute SDIV (fixed-base cache) function, its running time is  ------  %f ms\n", ((double)(end_time - start_time)) / 1 * 1000 / CLOCKS_PER_SEC);
+	gmp_printf("q = %Zd r = %Zd\n", x, y);
+	//one base raised to 64 full-width exponents, plain powm against the pinned table
+	mpz_t fe[64];
+	for (int i = 0; i < 64; i++) {
+		mpz_init(fe[i]);
+		mpz_urandomm(fe[i], gmp_rand, pai.pubkey.ns);
+	}
+	start_time = clock();
+	for (int i = 0; i < 64; i++) {
+		mpz_powm(z, cx, fe[i], pai.pubkey.nsquare);
+	}
+	end_time = clock();
+	double plain_ms = ((double)(end_time - start_time)) * 1000 / CLOCKS_PER_SEC;
+	fb.pin(cx);
+	start_time = clock();
+	for (int i = 0; i < 64; i++) {
+		cp.pai.scl_mul(z, cx, fe[i]);
+	}
+	end_time = clock();
+	double cached_ms = ((double)(end_time - start_time)) * 1000 / CLOCKS_PER_SEC;
+	printf("64 full-width exponentiations of one base: powm %f ms, fixed-base cache %f ms (%.1fx, table build included)\n",
+		plain_ms, cached_ms, plain_ms / cached_ms);
+	for (int i = 0; i < 64; i++) {
+		mpz_clear(fe[i]);
+	}
+	fb.report(stdout);
+	cp.pai.cache = NULL;
+	cout << "---------------------------" << endl;
+
+	//rolling SUM, MIN and MAX over the last 3 of the stream 7, 2, 9, 4, 1
+	sliding_window sw(cp, csp, 3);
+	window_result wr;
+	long stream[5] = { 7, 2, 9, 4, 1 };
+	start_time = clock();
+	for (int i = 0; i < 5; i++) {
+		mpz_set_si(x, stream[i]);
+		pai.encrypt(cx, x);
+		sw.push(cx);
+		sw.emit(wr);
+	}
+	end_time = clock();
+	pai.decrypt(x, wr.sum);
+	pai.decrypt(y, wr.min);
+	pai.decrypt(z, wr.max);
+	printf("compute sliding WINDOW function, its running time is  ------  %f ms\n", ((double)(end_time - start_time)) / 1 * 1000 / CLOCKS_PER_SEC);
+	gmp_printf("last window: count = %ld sum = %Zd min = %Zd max = %Zd\n", wr.count, x, y, z);
+	cout << "---------------------------" << endl;
+
+	//rolling SUM, AVG, MIN and MAX over the arrivals of the last 5 time units, checked against plaintext
+	sliding_window tw(cp, csp, 5, true, W_SUM | W_AVG | W_MIN | W_MAX);
+	long stamps[5] = { 1, 2, 4, 7, 8 };
+	bool window_ok = true;
+	start_time = clock();
+	for (int i = 0; i < 5; i++) {
+		mpz_set_si(x, stream[i]);
+		pai.encrypt(cx, x);
+		tw.push(cx, stamps[i]);
+		tw.emit(wr);
+		long s = 0, c = 0, lo = 0, hi = 0;
+		for (int j = 0; j <= i; j++) {
+			if (stamps[j] > stamps[i] - 5) {
+				lo = c == 0 || stream[j] < lo ? stream[j] : lo;
+				hi = c == 0 || stream[j] > hi ? stream[j] : hi;
+				s += stream[j];
+				c++;
+			}
+		}
+		pai.decrypt(x, wr.sum);
+		pai.decrypt(y, wr.min);
+		pai.decrypt(z, wr.max);
+		pai.decrypt(px, wr.avg);
+		window_ok = window_ok && wr.count == c && mpz_cmp_si(x, s) == 0 && mpz_cmp_si(px, s / c) == 0
+			&& mpz_cmp_si(y, lo) == 0 && mpz_cmp_si(z, hi) == 0;
+	}
+	end_time = clock();
+	printf("compute time WINDOW function (with AVG), its running time is  ------  %f ms\n", ((double)(end_time - start_time)) / 1 * 1000 / CLOCKS_PER_SEC);
+	gmp_printf("last window: count = %ld sum = %Zd avg = %Zd min = %Zd max = %Zd\n", wr.count, x, px, y, z);
+	printf(window_ok ? "all windows match the plaintext\n" : "windows do NOT match the plaintext\n");
+	cout << "---------------------------" << endl;
+
+	//SELECT k, SUM(v), COUNT(*) GROUP BY k over 6 rows with keys in [0, 3)
+	long gkeys[6] = { 2, 0, 2, 1, 0, 2 }, gvals[6] = { 10, 20, 30, 40, 50, 60 };
+	mpz_t gk[6], gv[6], gsum[3], gcount[3];
+	for (int i = 0; i < 6; i++) {
+		mpz_inits(gk[i], gv[i], NULL);
+		mpz_set_si(x, gkeys[i]);
+		pai.encrypt(gk[i], x);
+		mpz_set_si(x, gvals[i]);
+		pai.encrypt(gv[i], x);
+	}
+	for (int g = 0; g < 3; g++) {
+		mpz_inits(gsum[g], gcount[g], NULL);
+	}
+	group_by gb(cp, csp, 3);
+	start_time = clock();
+	gb.run(gsum, gcount, gk, gv, 6);
+	end_time = clock();
+	printf("compute GROUP BY function, its running time is  ------  %f ms\n", ((double)(end_time - start_time)) / 1 * 1000 / CLOCKS_PER_SEC);
+	for (int g = 0; g < 3; g++) {
+		pai.decrypt(x, gsum[g]);
+		pai.decrypt(y, gcount[g]);
+		gmp_printf("k = %d: sum = %Zd count = %Zd\n", g, x, y);
+		mpz_clears(gsum[g], gcount[g], NULL);
+	}
+	for (int i = 0; i < 6; i++) {
+		mpz_clears(gk[i], gv[i], NULL);
+	}
+	cout << "---------------------------" << endl;
+
+	//max pooling over groups of k = 5 (odd, the odd one out moves up twice), checked against plaintext
+	long pvals[10] = { 3, -1, 7, 2, 5, -4, -2, -9, -3, -6 };
+	mpz_t pin[10], pout[2];
+	for (int i = 0; i < 10; i++) {
+		mpz_init(pin[i]);
+		mpz_set_si(x, pvals[i]);
+		mpz_mod(x, x, pai.pubkey.ns);
+		pai.encrypt(pin[i], x);
+	}
+	mpz_inits(pout[0], pout[1], NULL);
+	nn net(cp, csp);
+	start_time = clock();
+	net.maxpool(pout, pin, 10, 5);
+	end_time = clock();
+	printf("compute MAXPOOL function, its running time is  ------  %f ms\n", ((double)(end_time - start_time)) / 1 * 1000 / CLOCKS_PER_SEC);
+	bool pool_ok = true;
+	for (int g = 0; g < 2; g++) {
+		long mx = pvals[g * 5];
+		for (int i = 1; i < 5; i++) {
+			mx = pvals[g * 5 + i] > mx ? pvals[g * 5 + i] : mx;
+		}
+		pai.decrypt(x, pout[g]);
+		if (mpz_cmp(x, pai.pubkey.half_n) > 0) {
+			mpz_sub(x, x, pai.pubkey.ns);
+		}
+		gmp_printf("group %d: max = %Zd (expected %ld)\n", g, x, mx);
+		pool_ok = pool_ok && mpz_cmp_si(x, mx) == 0;
+	}
+	printf(pool_ok ? "maxpool matches the plaintext\n" : "maxpool does NOT match the plaintext\n");
+	for (int i = 0; i < 10; i++) {
+		mpz_clear(pin[i]);
+	}
+	mpz_clears(pout[0], pout[1], NULL);
+	cout << "---------------------------" << endl;
+
 	mpz_clears(x, y, z, cx, cy, cz, px, py, NULL);
 	mpz_clears(c1, c2, NULL);
 	mpz_clears(s_x, u_x, NULL);
@@ -0,0 +1,175 @@
+#pragma once
+
+#include <stdio.h>
+#include <thread>
+#include <vector>
+#include "gmp.h"
+#include "paillier.h"
+#include "soci.h"
+#include "fbcache.h"
+#include "nn.h"
+
+using namespace phe;
+using namespace std;
+
+namespace soci {
+
+    /*
+    Micro-benchmark the kernels on this machine with a bits-bit key and
+    choose tune_config by timing the code that reads it: the thread count,
+    the round size of the batched protocols and the window widths of
+    fbcache and nn::dense. The ingest batch is not timed but derived as
+    chunk / threads (at least 16). Plain modular exponentiation mod n and
+    mod n^(s+1) is timed as the baseline of the window searches. Progress
+    goes to log if it is not NULL. gmp_rand must be initialized.
+    */
+    tune_config tune(int bits, FILE *log = NULL) {
+        tune_config cfg;
+        cfg.key_bits = bits;
+        int saved_threads = num_threads;
+
+        Paillier pai;
+        pai.keygen(bits);
+        PaillierThd cp, csp;
+        ThirdKeyGen tkg;
+        tkg.thdkeygen(pai, sigma, &cp, &csp);
+        mpz_t m, r;
+        mpz_inits(m, r, NULL);
+        mpz_set_ui(m, 1);
+
+        // threads: fastest batched encryption, ties (within 5%) go to fewer threads
+        int hc = thread::hardware_concurrency();
+        hc = hc > 0 ? hc : 1;
+        vector<int> cands;
+        for (int t = 1; t < hc; t *= 2) {
+            cands.push_back(t);
+        }
+        cands.push_back(hc);
+        int n = 4 * hc;
+        mpz_t *cs = new mpz_t[n];
+        for (int i = 0; i < n; i++) {
+            mpz_init(cs[i]);
+        }
+        double best = 0;
+        for (int t : cands) {
+            num_threads = t;
+            double us = time_us([&] { parallel_for(n, [&](long i) { pai.encrypt(cs[i], m); }); }, 200);
+            if (log != NULL) {
+                fprintf(log, "threads %d: %f us per encryption\n", t, us / n);
+            }
+            if (best == 0 || us < 0.95 * best) {
+                best = us;
+                cfg.threads = t;
+            }
+        }
+        num_threads = cfg.threads;
+        for (int i = 0; i < n; i++) {
+            mpz_clear(cs[i]);
+        }
+        delete[] cs;
+
+        // modexp: one full-width exponentiation mod n and mod n^(s+1)
+        mpz_t base, exp, out;
+        mpz_inits(base, exp, out, NULL);
+        mpz_urandomm(base, gmp_rand, pai.pubkey.n);
+        mpz_urandomm(exp, gmp_rand, pai.pubkey.n);
+        double powm_n = time_us([&] { mpz_powm(out, base, exp, pai.pubkey.n); });
+        mpz_urandomm(base, gmp_rand, pai.pubkey.nsquare);
+        mpz_urandomm(exp, gmp_rand, pai.pubkey.ns);
+        double powm_nsquare = time_us([&] { mpz_powm(out, base, exp, pai.pubkey.nsquare); });
+        if (log != NULL) {
+            fprintf(log, "powm mod n: %f us\n", powm_n);
+            fprintf(log, "powm mod n^(s+1): %f us\n", powm_nsquare);
+        }
+        mpz_clears(base, exp, out, NULL);
+
+        // chunk: per-element cost of one batched scmp round of c elements. c starts
+        // at 64 (and the thread count) and doubles while that saves more than 5%
+        const int most = 4096;
+        seccomp sc;
+        mpz_t *ex = new mpz_t[most], *ey = new mpz_t[most], *res = new mpz_t[most];
+        pai.encrypt(r, m);
+        for (int i = 0; i < most; i++) {
+            mpz_init_set(ex[i], r);
+            mpz_init_set(ey[i], r);
+            mpz_init(res[i]);
+        }
+        int c = 64;
+        while (c < cfg.threads && c < most) {
+            c *= 2;
+        }
+        cfg.chunk = c;
+        best = 0;
+        for (; c <= most; c *= 2) {
+            double us = time_us([&] { sc.scmp(res, ex, ey, c, cp, csp); }, 0) / c;
+            if (log != NULL) {
+                fprintf(log, "chunk %d: %f us per scmp\n", c, us);
+            }
+            if (best > 0 && us > 0.95 * best) {
+                break;
+            }
+            best = us;
+            cfg.chunk = c;
+        }
+        // batch: derived, one ingest batch per worker per round
+        cfg.batch = cfg.chunk / cfg.threads > 16 ? cfg.chunk / cfg.threads : 16;
+
+        // fb_window: per-exponentiation cost of one pinned base raised to 64
+        // full-width exponents, including the table built on first use
+        mpz_t *e = new mpz_t[64];
+        for (int i = 0; i < 64; i++) {
+            mpz_init(e[i]);
+            mpz_urandomm(e[i], gmp_rand, pai.pubkey.ns);
+        }
+        best = 0;
+        for (int w = 2; w <= 8; w++) {
+            double us = time_us([&] {
+                fbcache fb(pai.pubkey, 64 << 20, w);
+                fb.pin(r);
+                for (int i = 0; i < 64; i++) {
+                    fb.powm(res[i], r, e[i]);
+                }
+            }) / 64;
+            if (log != NULL) {
+                fprintf(log, "fbcache window %d: %f us per exponentiation (%.2fx powm)\n", w, us, powm_nsquare / us);
+            }
+            if (best == 0 || us < best) {
+                best = us;
+                cfg.fb_window = w;
+            }
+        }
+        for (int i = 0; i < 64; i++) {
+            mpz_clear(e[i]);
+        }
+        delete[] e;
+
+        // nn_window: a 64 -> 32 dense layer with 7-bit weights, as in soci mlp
+        const int n_in = 64, n_out = 32;
+        vector<long> wts((long)n_in * n_out);
+        for (long i = 0; i < (long)wts.size(); i++) {
+            wts[i] = (long)((i * 2654435761UL) % 129) - 64;
+        }
+        best = 0;
+        for (int w = 1; w <= 8; w++) {
+            nn net(cp, csp, w);
+            double us = time_us([&] { net.dense(res, ex, 1, n_in, n_out, wts.data(), NULL); });
+            if (log != NULL) {
+                fprintf(log, "dense window %d: %f us per layer\n", w, us);
+            }
+            if (best == 0 || us < best) {
+                best = us;
+                cfg.nn_window = w;
+            }
+        }
+
+        for (int i = 0; i < most; i++) {
+            mpz_clears(ex[i], ey[i], res[i], NULL);
+        }
+        delete[] ex;
+        delete[] ey;
+        delete[] res;
+        mpz_clears(m, r, NULL);
+        num_threads = saved_threads;
+        return cfg;
+    }
+}
@@ -0,0 +1,228 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include "gmp.h"
+#include "paillier.h"
+#include "parallel.h"
+#include "tune.h"
+
+using namespace phe;
+using namespace std;
+
+namespace soci {
+
+    /*
+    Ciphertext column files hold fixed-width records: every ciphertext is
+    stored big-endian in cipher_bytes(pk) bytes, so record i is at offset
+    i * cipher_bytes(pk).
+    */
+    size_t cipher_bytes(const PaillierKey &pk) {
+        return (mpz_sizeinbase(pk.nsquare, 2) + 7) / 8;
+    }
+
+    void put_cipher(unsigned char *buf, const mpz_t c, size_t bytes) {
+        size_t count = 0;
+        size_t len = (mpz_sizeinbase(c, 2) + 7) / 8;
+        memset(buf, 0, bytes - len);
+        mpz_export(buf + bytes - len, &count, 1, 1, 1, 0, c);
+        if (count == 0) {
+            buf[bytes - 1] = 0;
+        }
+    }
+
+    void get_cipher(mpz_t c, const unsigned char *buf, size_t bytes) {
+        mpz_import(c, bytes, 1, 1, 1, 0, buf);
+    }
+
+    /*
+    Read-only view of x without copying, e.g. to pass strided or repeated
+    inputs to a batched protocol. Like CipherVector::view(), it must not be
+    written to or cleared, and is valid while x is unchanged.
+    */
+    mpz_srcptr view_of(mpz_t v, const mpz_t x) {
+        return mpz_roinit_n(v, mpz_limbs_read(x), mpz_size(x));
+    }
+
+    /*
+    Ciphertexts of one key in a single 64-byte aligned allocation.
+    Slot i holds the limbs of ciphertext i, least significant first, zero
+    padded to a fixed stride of whole cache lines, so a column is one
+    allocation and is walked sequentially.
+    view() returns a read-only mpz over a slot (mpz_roinit_n) for any
+    const mpz_t parameter. A view must not be written to or cleared.
+    */
+    class CipherVector {
+
+    public:
+        CipherVector(const PaillierKey &pk, size_t n = 0) {
+            size_t line = 64 / sizeof(mp_limb_t);
+            size_t need = (mpz_sizeinbase(pk.nsquare, 2) + GMP_NUMB_BITS - 1) / GMP_NUMB_BITS;
+            this->width = (need + line - 1) / line * line;
+            this->bytes = cipher_bytes(pk);
+            mpz_init_set(this->nsquare, pk.nsquare);
+            resize(n);
+        }
+
+        CipherVector(const CipherVector &) = delete;
+        CipherVector& operator=(const CipherVector &) = delete;
+
+        ~CipherVector() {
+            mpz_clear(nsquare);
+            free(limbs);
+        }
+
+        size_t size() const { return n; }
+        size_t stride() const { return width; }     // limbs per slot
+        mp_limb_t *data() { return limbs; }
+
+        void resize(size_t n);
+        void set(size_t i, const mpz_t c);
+        void get(mpz_t c, size_t i) const;
+        mpz_srcptr view(mpz_t v, size_t i) const;
+        void push_back(const mpz_t c);
+        void encrypt(mpz_t *m, size_t n, Paillier &pai);
+        void sum(mpz_t res, Paillier &pai) const;
+        bool load(const char *path);
+        bool save(const char *path) const;
+
+    private:
+        mp_limb_t *limbs = NULL;
+        size_t n = 0, cap = 0, width, bytes;
+        mpz_t nsquare;                  // n^(s+1), the bound checked by load()
+
+        void reserve(size_t cap);
+    };
+
+    void CipherVector::reserve(size_t cap) {
+        if (cap <= this->cap) {
+            return;
+        }
+        size_t slot = width * sizeof(mp_limb_t);
+        mp_limb_t *p = (mp_limb_t *)aligned_alloc(64, cap * slot);
+        if (p == NULL) {
+            throw("cannot allocate the cipher vector");
+        }
+        if (limbs != NULL) {
+            memcpy(p, limbs, n * slot);
+            free(limbs);
+        }
+        limbs = p;
+        this->cap = cap;
+    }
+
+    /*New slots hold 0, which is not a valid ciphertext until set*/
+    void CipherVector::resize(size_t n) {
+        if (n > cap) {
+            reserve(n > 2 * cap ? n : 2 * cap);
+        }
+        if (n > this->n) {
+            memset(limbs + this->n * width, 0, (n - this->n) * width * sizeof(mp_limb_t));
+        }
+        this->n = n;
+    }
+
+    void CipherVector::set(size_t i, const mpz_t c) {
+        size_t k = mpz_size(c);
+        if (k > width || mpz_sgn(c) < 0) {
+            throw("ciphertext must be less than n^(s+1)");
+        }
+        mp_limb_t *slot = limbs + i * width;
+        memcpy(slot, mpz_limbs_read(c), k * sizeof(mp_limb_t));
+        memset(slot + k, 0, (width - k) * sizeof(mp_limb_t));
+    }
+
+    void CipherVector::get(mpz_t c, size_t i) const {
+        mpz_t v;
+        mpz_set(c, view(v, i));
+    }
+
+    mpz_srcptr CipherVector::view(mpz_t v, size_t i) const {
+        return mpz_roinit_n(v, limbs + i * width, width);
+    }
+
+    void CipherVector::push_back(const mpz_t c) {
+        resize(n + 1);
+        set(n - 1, c);
+    }
+
+    /*Encrypt m[0..n) into this vector on the worker threads*/
+    void CipherVector::encrypt(mpz_t *m, size_t n, Paillier &pai) {
+        resize(n);
+        parallel_for(n, [&](long i) {
+            mpz_t c;
+            mpz_init2(c, width * GMP_NUMB_BITS);
+            pai.encrypt(c, m[i]);
+            set(i, c);
+            mpz_clear(c);
+        });
+    }
+
+    /*res = [sum of all plaintexts], one sequential pass per worker*/
+    void CipherVector::sum(mpz_t res, Paillier &pai) const {
+        int parts = get_num_threads();
+        parts = (size_t)parts > n ? (n > 0 ? n : 1) : parts;
+        mpz_t *part = new mpz_t[parts];
+        parallel_for(parts, [&](int p) {
+            mpz_init_set_ui(part[p], 1);        // [0] with randomness 1
+            size_t lo = n * p / parts, hi = n * (p + 1) / parts;
+            mpz_t v;
+            for (size_t i = lo; i < hi; i++) {
+                pai.add(part[p], part[p], view(v, i));
+            }
+        });
+        mpz_set(res, part[0]);
+        mpz_clear(part[0]);
+        for (int p = 1; p < parts; p++) {
+            pai.add(res, res, part[p]);
+            mpz_clear(part[p]);
+        }
+        delete[] part;
+    }
+
+    /*
+    Read a ciphertext column file written by ingest or save().
+    Fails on a short record or a value not less than n^(s+1).
+    */
+    bool CipherVector::load(const char *path) {
+        FILE *fp = fopen(path, "rb");
+        if (fp == NULL) {
+            return false;
+        }
+        vector<unsigned char> buf(bytes);
+        mpz_t c;
+        mpz_init2(c, width * GMP_NUMB_BITS);
+        resize(0);
+        bool ok = true;
+        size_t got;
+        while ((got = fread(buf.data(), 1, bytes, fp)) == bytes) {
+            get_cipher(c, buf.data(), bytes);
+            if (mpz_cmp(c, nsquare) >= 0) {
+                ok = false;
+                break;
+            }
+            push_back(c);
+        }
+        ok = ok && got == 0 && !ferror(fp);
+        mpz_clear(c);
+        fclose(fp);
+        return ok;
+    }
+
+    bool CipherVector::save(const char *path) const {
+        FILE *fp = fopen(path, "wb");
+        if (fp == NULL) {
+            return false;
+        }
+        vector<unsigned char> buf(bytes);
+        mpz_t v;
+        bool ok = true;
+        for (size_t i = 0; i < n && ok; i++) {
+            put_cipher(buf.data(), view(v, i), bytes);
+            ok = fwrite(buf.data(), 1, bytes, fp) == bytes;
+        }
+        return fclose(fp) == 0 && ok;
+    }
+}
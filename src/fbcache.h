@@ -0,0 +1,303 @@
+#pragma once
+
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+#include <iterator>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include "gmp.h"
+#include "paillier.h"
+#include "ciphervec.h"
+#include "tune.h"
+
+using namespace phe;
+using namespace std;
+
+namespace soci {
+
+    /*
+    Fixed-base precomputation for ciphertexts that are exponentiated again
+    and again, e.g. [y] in sdiv or the entries of a column in a public
+    weighted sum. Attach it with pai.cache = &fb (or cp.pai.cache = &fb)
+    and admit the hot bases with pin(c). Any other base goes straight to
+    mpz_powm: with nothing pinned that costs one atomic load, otherwise one
+    hash lookup of its lowest limb, and nothing is copied or queued.
+
+    The first exponentiation of a pinned base builds a table
+    T[j][d] = c^(d*2^(w*j)), and c^e costs one multiplication per non-zero
+    w-bit digit of e instead of |e| squarings. Rows are added on demand, so
+    short exponents only pay for short tables. A negative e is handled as
+    (c^|e|)^(-1). Pinned bases are evicted least recently used first once
+    the tables exceed max_bytes, and must then be pinned again. Safe to
+    share between threads. window 0 means the tuned width (see tune.h).
+    */
+    class fbcache : public powm_cache {
+
+    public:
+        PaillierKey key;
+        size_t max_bytes;
+        int window;
+
+        fbcache(const PaillierKey &pk, size_t max_bytes = 64 << 20, int window = 0)
+            : key(pk), max_bytes(max_bytes), window(window > 0 ? window : tuned(pk).fb_window) {
+        }
+
+        fbcache(const fbcache &) = delete;
+        fbcache& operator=(const fbcache &) = delete;
+
+        void pin(const mpz_t c);
+        void unpin(const mpz_t c);
+        void powm(mpz_t res, const mpz_t c, const mpz_t e) override;
+        void clear();
+        size_t bytes();
+        void report(FILE *fp);
+
+    private:
+        struct table {
+            int rows;
+            CipherVector t;     // row j, digit d at slot (j << window) + d
+
+            table(const PaillierKey &pk, int rows, int window) : rows(rows), t(pk, (size_t)rows << window) {
+            }
+        };
+
+        struct entry {
+            string base;
+            bool building = false;
+            shared_ptr<table> tab;
+        };
+
+        list<entry> lru;        // pinned bases, most recently used first
+        unordered_multimap<mp_limb_t, list<entry>::iterator> index;     // by lowest limb
+        mutex mtx;
+        atomic<size_t> pinned{0};
+        size_t used = 0;
+        long hits = 0, misses = 0, builds = 0, evictions = 0;
+        atomic<long> bypasses{0};
+
+        static mp_limb_t low(const mpz_t c) { return mpz_size(c) > 0 ? mpz_limbs_read(c)[0] : 0; }
+        list<entry>::iterator find(const mpz_t c);
+        void drop(list<entry>::iterator it);
+        shared_ptr<table> build(const mpz_t c, shared_ptr<table> old, int rows);
+        size_t cost(const entry &en);
+        void evict();
+    };
+
+    /*Entry of the pinned base c, or lru.end(), mtx is held*/
+    list<fbcache::entry>::iterator fbcache::find(const mpz_t c) {
+        size_t len = mpz_size(c) * sizeof(mp_limb_t);
+        auto range = index.equal_range(low(c));
+        for (auto it = range.first; it != range.second; ++it) {
+            const string &b = it->second->base;
+            if (b.size() == len && memcmp(b.data(), mpz_limbs_read(c), len) == 0) {
+                return it->second;
+            }
+        }
+        return lru.end();
+    }
+
+    /*Forget a pinned base and its table, mtx is held*/
+    void fbcache::drop(list<entry>::iterator it) {
+        mp_limb_t k = it->base.size() >= sizeof(mp_limb_t) ? *(const mp_limb_t *)it->base.data() : 0;
+        auto range = index.equal_range(k);
+        for (auto ix = range.first; ix != range.second; ++ix) {
+            if (ix->second == it) {
+                index.erase(ix);
+                break;
+            }
+        }
+        used -= cost(*it);
+        lru.erase(it);
+        pinned--;
+    }
+
+    size_t fbcache::cost(const entry &en) {
+        size_t b = en.base.size() + sizeof(entry);
+        if (en.tab) {
+            b += en.tab->t.size() * en.tab->t.stride() * sizeof(mp_limb_t);
+        }
+        return b;
+    }
+
+    /*Drop least recently used entries until the cache fits max_bytes, mtx is held*/
+    void fbcache::evict() {
+        while (used > max_bytes && !lru.empty()) {
+            if (lru.back().building) {
+                break;
+            }
+            drop(prev(lru.end()));
+            evictions++;
+        }
+    }
+
+    /*Admit c, its table is built by the first exponentiation*/
+    void fbcache::pin(const mpz_t c) {
+        lock_guard<mutex> lock(mtx);
+        if (find(c) != lru.end()) {
+            return;
+        }
+        lru.push_front(entry());
+        lru.front().base.assign((const char *)mpz_limbs_read(c), mpz_size(c) * sizeof(mp_limb_t));
+        index.emplace(low(c), lru.begin());
+        used += cost(lru.front());
+        pinned++;
+        evict();
+    }
+
+    /*Forget c and its table, unless the table is being built*/
+    void fbcache::unpin(const mpz_t c) {
+        lock_guard<mutex> lock(mtx);
+        auto it = find(c);
+        if (it != lru.end() && !it->building) {
+            drop(it);
+        }
+    }
+
+    /*Table with rows rows, reusing the rows of old*/
+    shared_ptr<fbcache::table> fbcache::build(const mpz_t c, shared_ptr<table> old, int rows) {
+        shared_ptr<table> tb = make_shared<table>(key, rows, window);
+        int d = 1 << window, from = 0;
+        mpz_t x, v, u;
+        mpz_init(x);
+        if (old) {
+            from = old->rows;
+            for (size_t i = 0; i < old->t.size(); i++) {
+                tb->t.set(i, old->t.view(v, i));
+            }
+        }
+        for (int j = from; j < rows; j++) {
+            size_t r = (size_t)j << window;
+            mpz_set_ui(x, 1);
+            tb->t.set(r, x);
+            if (j == 0) {
+                mpz_set(x, c);
+            }
+            else {
+                size_t p = (size_t)(j - 1) << window;       // c^(2^(w*j)) = c^((2^w-1)*2^(w*(j-1))) * c^(2^(w*(j-1)))
+                mpz_mul(x, tb->t.view(v, p + d - 1), tb->t.view(u, p + 1));
+                mpz_mod(x, x, key.nsquare);
+            }
+            tb->t.set(r + 1, x);
+            for (int k = 2; k < d; k++) {
+                mpz_mul(x, x, tb->t.view(v, r + 1));
+                mpz_mod(x, x, key.nsquare);
+                tb->t.set(r + k, x);
+            }
+        }
+        mpz_clear(x);
+        return tb;
+    }
+
+    void fbcache::powm(mpz_t res, const mpz_t c, const mpz_t e) {
+        size_t bits = mpz_sizeinbase(e, 2);
+        if (bits <= (size_t)window) {               // short exponents gain nothing
+            mpz_powm(res, c, e, key.nsquare);
+            return;
+        }
+        if (pinned == 0) {
+            bypasses++;
+            mpz_powm(res, c, e, key.nsquare);
+            return;
+        }
+        int rows = (bits + window - 1) / window;
+        int full = (mpz_sizeinbase(key.ns, 2) + window - 1) / window;
+
+        shared_ptr<table> tb;
+        bool known = false, grow = false;
+        int grow_to = 0;
+        {
+            lock_guard<mutex> lock(mtx);
+            auto it = find(c);
+            if (it != lru.end()) {
+                known = true;
+                lru.splice(lru.begin(), lru, it);
+                entry &en = *it;
+                tb = en.tab;
+                if ((!tb || tb->rows < rows) && !en.building) {
+                    en.building = grow = true;
+                    grow_to = tb && 2 * tb->rows > rows ? 2 * tb->rows : rows;     // doubling keeps rebuilds logarithmic
+                    grow_to = grow_to < full ? grow_to : full;
+                }
+                if (tb && tb->rows >= rows) {
+                    hits++;
+                }
+                else {
+                    misses++;
+                }
+            }
+        }
+        if (!known) {
+            bypasses++;
+            mpz_powm(res, c, e, key.nsquare);
+            return;
+        }
+
+        if (grow) {
+            shared_ptr<table> nt = build(c, tb, grow_to);
+            lock_guard<mutex> lock(mtx);
+            auto it = find(c);
+            if (it != lru.end()) {
+                entry &en = *it;
+                used -= cost(en);
+                en.tab = nt;
+                en.building = false;
+                used += cost(en);
+            }
+            builds++;
+            evict();
+            tb = nt;
+        }
+
+        if (!tb || tb->rows < rows) {
+            mpz_powm(res, c, e, key.nsquare);
+            return;
+        }
+
+        mpz_t acc, v, a;
+        mpz_init_set_ui(acc, 1);
+        mpz_init(a);
+        mpz_abs(a, e);
+        for (int j = 0; j < rows; j++) {
+            int dg = 0;
+            for (int k = window - 1; k >= 0; k--) {
+                dg = (dg << 1) | mpz_tstbit(a, (mp_bitcnt_t)j * window + k);
+            }
+            if (dg != 0) {
+                mpz_mul(acc, acc, tb->t.view(v, ((size_t)j << window) + dg));
+                mpz_mod(acc, acc, key.nsquare);
+            }
+        }
+        if (mpz_sgn(e) < 0) {
+            mpz_invert(acc, acc, key.nsquare);
+        }
+        mpz_swap(res, acc);
+        mpz_clears(acc, a, NULL);
+    }
+
+    /*Unpin every base whose table is not being built*/
+    void fbcache::clear() {
+        lock_guard<mutex> lock(mtx);
+        for (auto it = lru.begin(); it != lru.end();) {
+            auto nx = next(it);
+            if (!it->building) {
+                drop(it);
+            }
+            it = nx;
+        }
+    }
+
+    size_t fbcache::bytes() {
+        lock_guard<mutex> lock(mtx);
+        return used;
+    }
+
+    void fbcache::report(FILE *fp) {
+        lock_guard<mutex> lock(mtx);
+        fprintf(fp, "fixed-base cache: %zu pinned bases, %zu bytes, window %d, hits %ld, misses %ld, builds %ld, evictions %ld, bypasses %ld\n",
+            lru.size(), used, window, hits, misses, builds, evictions, bypasses.load());
+    }
+}
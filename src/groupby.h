@@ -0,0 +1,254 @@
+#pragma once
+
+#include "gmp.h"
+#include "paillier.h"
+#include "soci.h"
+#include "tune.h"
+
+using namespace phe;
+using namespace std;
+
+namespace soci {
+
+    /*
+    Encrypted GROUP BY over a key column with the small public domain
+    [0, groups), SELECT k, SUM(v), COUNT(*) GROUP BY k, which is also a
+    histogram of k. Keys outside the domain are not supported.
+
+    Every key is compared with the constants 1..groups-1, lt_g = [k < g],
+    and the one-hot indicator of group g is lt_{g+1} - lt_g. The operator
+    accumulates S_g = sum [k_i < g] * v_i and C_g = sum [k_i < g] instead,
+    so a row costs groups-1 comparisons and groups-1 multiplications, and
+    SUM_g = S_{g+1} - S_g and COUNT_g = C_{g+1} - C_g at the end.
+    Rows are fed in chunks of about chunk comparisons, each chunk is one
+    batched scmp round and one batched smul round on the worker threads.
+    */
+    class group_by {
+
+    public:
+        PaillierThd cp, csp;
+        seccomp sc;
+        int groups, chunk;
+
+        group_by(PaillierThd cp, PaillierThd csp, int groups, int chunk = 0)
+            : cp(cp), csp(csp), groups(groups), chunk(chunk > 0 ? chunk : tuned(cp.pai.pubkey).chunk) {
+            if (groups < 1) {
+                throw("there must be at least one group");
+            }
+            this->rows = this->chunk / groups > 0 ? this->chunk / groups : 1;
+            int t = groups - 1;
+            this->eg = new mpz_t[t];
+            this->ssum = new mpz_t[t];
+            this->scount = new mpz_t[t];
+            this->lt = new mpz_t[(long)rows * t];
+            this->prod = new mpz_t[(long)rows * t];
+            this->kx = new mpz_t[(long)rows * t];
+            this->vx = new mpz_t[(long)rows * t];
+            this->gx = new mpz_t[(long)rows * t];
+            mpz_t g;
+            mpz_init(g);
+            for (int i = 0; i < t; i++) {
+                mpz_inits(this->eg[i], this->ssum[i], this->scount[i], NULL);
+                mpz_set_ui(g, i + 1);
+                cp.pai.encrypt(this->eg[i], g);
+            }
+            mpz_clear(g);
+            for (long i = 0; i < (long)rows * t; i++) {
+                mpz_inits(this->lt[i], this->prod[i], NULL);
+                view_of(this->gx[i], this->eg[i % t]);
+            }
+            mpz_init(this->total);
+            mpz_init(this->eall);
+        }
+
+        group_by(const group_by &) = delete;
+        group_by& operator=(const group_by &) = delete;
+
+        ~group_by() {
+            int t = groups - 1;
+            for (int i = 0; i < t; i++) {
+                mpz_clears(eg[i], ssum[i], scount[i], NULL);
+            }
+            for (long i = 0; i < (long)rows * t; i++) {
+                mpz_clears(lt[i], prod[i], NULL);
+            }
+            mpz_clears(total, eall, NULL);
+            delete[] eg;
+            delete[] ssum;
+            delete[] scount;
+            delete[] lt;
+            delete[] prod;
+            delete[] kx;
+            delete[] vx;
+            delete[] gx;
+        }
+
+        void begin();
+        void feed(mpz_t *k, mpz_t *v, long n);
+        void feed(const CipherVector &k, const CipherVector *v);
+        void finish(mpz_t *esum, mpz_t *ecount);
+        void run(mpz_t *esum, mpz_t *ecount, mpz_t *k, mpz_t *v, long n);
+        void onehot(mpz_t *eq, mpz_t *k, long n);
+
+    private:
+        int rows;                       // rows per chunk
+        mpz_t *eg;                      // [g] for g = 1..groups-1
+        mpz_t *ssum, *scount;           // S_g and C_g for g = 1..groups-1
+        mpz_t total, eall;              // [SUM(v)] and the public row count so far
+        mpz_t *lt, *prod;               // rows x (groups-1) scratch
+        mpz_t *kx, *vx, *gx;            // rows x (groups-1) read-only views of k_i, v_i and [g]
+        long nrows = 0;
+        bool with_sum = false;
+
+        void compare(mpz_t *k, int m);
+    };
+
+    /*lt[i*(groups-1) + g-1] = [k_i < g] for the m rows, one batched scmp round*/
+    void group_by::compare(mpz_t *k, int m) {
+        int t = groups - 1;
+        for (long j = 0; j < (long)m * t; j++) {
+            view_of(kx[j], k[j / t]);
+        }
+        sc.scmp(lt, kx, gx, m * t, cp, csp);
+    }
+
+    /*Start a new aggregation*/
+    void group_by::begin() {
+        for (int i = 0; i < groups - 1; i++) {
+            mpz_set(ssum[i], cp.ezero);
+            mpz_set(scount[i], cp.ezero);
+        }
+        mpz_set(total, cp.ezero);
+        nrows = 0;
+        with_sum = false;
+    }
+
+    /*
+    Aggregate the next n rows. v may be NULL, in which case only COUNT is
+    computed and the smul round is skipped.
+    */
+    void group_by::feed(mpz_t *k, mpz_t *v, long n) {
+        int t = groups - 1;
+        nrows += n;
+        if (v != NULL) {
+            with_sum = true;
+            for (long i = 0; i < n; i++) {
+                cp.pai.add(total, total, v[i]);
+            }
+        }
+        if (t == 0) {
+            return;
+        }
+        for (long off = 0; off < n; off += rows) {
+            int m = n - off < rows ? n - off : rows;
+
+            // Round 1: lt[i][g] = [k_i < g]
+            compare(k + off, m);
+
+            // Round 2: prod[i][g] = [(k_i < g) * v_i]
+            if (v != NULL) {
+                for (long j = 0; j < (long)m * t; j++) {
+                    view_of(vx[j], v[off + j / t]);
+                }
+                sc.smul(prod, lt, vx, m * t, cp, csp);
+            }
+
+            // fold the chunk into the accumulators, one threshold per task
+            parallel_for(t, [&](int g) {
+                for (int i = 0; i < m; i++) {
+                    cp.pai.add(scount[g], scount[g], lt[(long)i * t + g]);
+                    if (v != NULL) {
+                        cp.pai.add(ssum[g], ssum[g], prod[(long)i * t + g]);
+                    }
+                }
+            });
+        }
+    }
+
+    /*Aggregate the rows of a key column and an optional value column, read in place through views*/
+    void group_by::feed(const CipherVector &k, const CipherVector *v) {
+        mpz_t *kv = new mpz_t[rows], *vv = new mpz_t[rows];
+        for (size_t off = 0; off < k.size(); off += rows) {
+            int m = k.size() - off < (size_t)rows ? k.size() - off : rows;
+            for (int i = 0; i < m; i++) {
+                k.view(kv[i], off + i);
+                if (v != NULL) {
+                    v->view(vv[i], off + i);
+                }
+            }
+            feed(kv, v != NULL ? vv : NULL, m);
+        }
+        delete[] kv;
+        delete[] vv;
+    }
+
+    /*
+    esum[g] = [SUM(v) of group g] and ecount[g] = [COUNT(*) of group g] for
+    g = 0..groups-1. esum may be NULL. Without values esum holds [0].
+    */
+    void group_by::finish(mpz_t *esum, mpz_t *ecount) {
+        int t = groups - 1;
+        mpz_t m;
+        mpz_init_set_si(m, nrows);
+        cp.pai.encrypt(eall, m);
+        mpz_clear(m);
+        parallel_for(groups, [&](int g) {
+            // X_g = X_{g+1} - X_g with X_0 = [0] and X_groups = the total
+            const mpz_srcptr hs = g < t ? ssum[g] : total, hc = g < t ? scount[g] : eall;
+            mpz_t neg;
+            mpz_init(neg);
+            if (esum != NULL) {
+                if (!with_sum) {
+                    mpz_set(esum[g], cp.ezero);
+                }
+                else if (g == 0) {
+                    mpz_set(esum[g], hs);
+                }
+                else {
+                    cp.pai.scl_mul(neg, ssum[g - 1], sc.neg_one);
+                    cp.pai.add(esum[g], hs, neg);
+                }
+            }
+            if (g == 0) {
+                mpz_set(ecount[g], hc);
+            }
+            else {
+                cp.pai.scl_mul(neg, scount[g - 1], sc.neg_one);
+                cp.pai.add(ecount[g], hc, neg);
+            }
+            mpz_clear(neg);
+        });
+    }
+
+    /*Aggregate n rows held in memory*/
+    void group_by::run(mpz_t *esum, mpz_t *ecount, mpz_t *k, mpz_t *v, long n) {
+        begin();
+        feed(k, v, n);
+        finish(esum, ecount);
+    }
+
+    /*eq[i*groups + g] = [k_i == g], the one-hot encoding of n keys*/
+    void group_by::onehot(mpz_t *eq, mpz_t *k, long n) {
+        int t = groups - 1;
+        for (long off = 0; off < n; off += rows) {
+            int m = n - off < rows ? n - off : rows;
+            compare(k + off, m);
+            parallel_for((long)m * groups, [&](long j) {
+                long i = j / groups;
+                int g = j % groups;
+                mpz_ptr out = eq[(off + i) * groups + g];
+                mpz_t neg;
+                mpz_init(neg);
+                const mpz_srcptr hi = g < t ? lt[i * t + g] : cp.eone;
+                if (g == 0) {
+                    mpz_set(out, hi);
+                }
+                else {
+                    cp.pai.scl_mul(neg, lt[i * t + g - 1], sc.neg_one);
+                    cp.pai.add(out, hi, neg);
+                }
+                mpz_clear(neg);
+            });
+        }
+    }
+}
@@ -0,0 +1,152 @@
+#pragma once
+
+#include "gmp.h"
+#include "paillier.h"
+#include "soci.h"
+#include "tune.h"
+
+using namespace phe;
+using namespace std;
+
+namespace soci {
+
+    /*
+    Leakage of a search on sorted_index.
+    REVEAL_ACCESS: binary search, O(log n) scmp rounds, the probed positions
+                   (and thus the result position) are revealed to CP and CSP.
+    HIDE_ACCESS:   every key is probed in one batched scmp round, O(n) work,
+                   nothing but n is revealed.
+    */
+    enum leakage { REVEAL_ACCESS, HIDE_ACCESS };
+
+    /*
+    Encrypted sorted index held by CP over a borrowed key column.
+    keys must be encryptions of a non-decreasing sequence and must outlive the index.
+    Only REVEAL_ACCESS searches in O(log n) rounds; HIDE_ACCESS is a linear scan of every key.
+    */
+    class sorted_index {
+
+    public:
+        const CipherVector &keys;
+        int n;
+        leakage mode;
+        PaillierThd cp, csp;
+        seccomp sc;
+
+        sorted_index(const CipherVector &keys, PaillierThd cp, PaillierThd csp, leakage mode = REVEAL_ACCESS)
+            : keys(keys), n((int)keys.size()), mode(mode), cp(cp), csp(csp) {}
+
+        sorted_index(const sorted_index &) = delete;
+        sorted_index& operator=(const sorted_index &) = delete;
+
+        void lower_bound(mpz_t epos, const mpz_t ek);
+        void upper_bound(mpz_t epos, const mpz_t ek);
+        void range(mpz_t elb, mpz_t eub, const mpz_t elo, const mpz_t ehi);
+        void lookup(mpz_t ecount, const mpz_t ek);
+
+    private:
+        void search(mpz_t epos, const mpz_t ek, bool upper);
+        int reveal(const mpz_t c);
+    };
+
+    /*Joint decryption of c by CP and CSP*/
+    int sorted_index::reveal(const mpz_t c) {
+        mpz_t c1, c2, m;
+        mpz_inits(c1, c2, m, NULL);
+        cp.pdec(c1, c);
+        csp.pdec(c2, c);
+        csp.fdec(m, c1, c2);
+        int b = mpz_get_si(m);
+        mpz_clears(c1, c2, m, NULL);
+        return b;
+    }
+
+    /*
+    epos = [#{i : keys[i] < k}] if upper is false,
+    epos = [#{i : keys[i] <= k}] if upper is true.
+    */
+    void sorted_index::search(mpz_t epos, const mpz_t ek, bool upper) {
+        mpz_t b;
+        mpz_init(b);
+        if (mode == REVEAL_ACCESS) {
+            int lo = 0, hi = n;
+            while (lo < hi) {
+                int mid = lo + (hi - lo) / 2;
+                mpz_t v;
+                mpz_srcptr key = keys.view(v, mid);
+                if (upper) {
+                    sc.scmp(b, ek, key, cp, csp);     // [k < keys[mid]]
+                    reveal(b) ? hi = mid : lo = mid + 1;
+                }
+                else {
+                    sc.scmp(b, key, ek, cp, csp);     // [keys[mid] < k]
+                    reveal(b) ? lo = mid + 1 : hi = mid;
+                }
+            }
+            mpz_set_ui(b, lo);
+            cp.pai.encrypt(epos, b);
+        }
+        else {
+            const int chunk = tuned(cp.pai.pubkey).chunk;
+            mpz_t *bits = new mpz_t[chunk];
+            mpz_t *kv = new mpz_t[chunk];                          // read-only views into keys
+            for (int i = 0; i < chunk; i++) {
+                mpz_init(bits[i]);
+            }
+            mpz_set(epos, cp.ezero);
+            for (int off = 0; off < n; off += chunk) {
+                int m = n - off < chunk ? n - off : chunk;
+                for (int i = 0; i < m; i++) {
+                    keys.view(kv[i], off + i);
+                }
+                if (upper) {
+                    sc.scmp(bits, ek, kv, m, cp, csp);     // [k < keys[i]]
+                }
+                else {
+                    sc.scmp(bits, kv, ek, m, cp, csp);     // [keys[i] < k]
+                }
+                for (int i = 0; i < m; i++) {
+                    cp.pai.add(epos, epos, bits[i]);
+                }
+            }
+            if (upper) {                                            // [#{i : keys[i] <= k}]
+                mpz_set_ui(b, n);
+                cp.pai.encrypt(b, b);
+                cp.pai.scl_mul(epos, epos, sc.neg_one);
+                cp.pai.add(epos, b, epos);
+            }
+            for (int i = 0; i < chunk; i++) {
+                mpz_clear(bits[i]);
+            }
+            delete[] bits;
+            delete[] kv;
+        }
+        mpz_clear(b);
+    }
+
+    /*epos = [first position whose key is not less than k]*/
+    void sorted_index::lower_bound(mpz_t epos, const mpz_t ek) {
+        search(epos, ek, false);
+    }
+
+    /*epos = [first position whose key is greater than k]*/
+    void sorted_index::upper_bound(mpz_t epos, const mpz_t ek) {
+        search(epos, ek, true);
+    }
+
+    /*keys[lb..ub) are exactly the keys in [lo, hi]*/
+    void sorted_index::range(mpz_t elb, mpz_t eub, const mpz_t elo, const mpz_t ehi) {
+        search(elb, elo, false);
+        search(eub, ehi, true);
+    }
+
+    /*ecount = [#{i : keys[i] == k}]*/
+    void sorted_index::lookup(mpz_t ecount, const mpz_t ek) {
+        mpz_t elb;
+        mpz_init(elb);
+        range(elb, ecount, ek, ek);
+        cp.pai.scl_mul(elb, elb, sc.neg_one);
+        cp.pai.add(ecount, ecount, elb);
+        mpz_clear(elb);
+    }
+}
@@ -0,0 +1,408 @@
+#pragma once
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include "gmp.h"
+#include "paillier.h"
+#include "parallel.h"
+#include "ciphervec.h"
+#include "tune.h"
+
+using namespace phe;
+using namespace std;
+
+namespace soci {
+
+    /*Seed gmp_rand from /dev/urandom, setrandom() leaves it at the default seed*/
+    void seed_random() {
+        unsigned char buf[32];
+        FILE *fp = fopen("/dev/urandom", "rb");
+        if (fp == NULL) {
+            throw("cannot read /dev/urandom");
+        }
+        size_t got = fread(buf, 1, sizeof(buf), fp);
+        fclose(fp);
+        if (got != sizeof(buf)) {
+            throw("cannot read /dev/urandom");
+        }
+        mpz_t seed;
+        mpz_init(seed);
+        mpz_import(seed, sizeof(buf), 1, 1, 1, 0, buf);
+        gmp_randseed(gmp_rand, seed);
+        mpz_clear(seed);
+    }
+
+    /*
+    Key files are text files:
+    public key:  s, n
+    private key: s, n, lambda
+    with n and lambda in hexadecimal.
+    */
+    bool save_pubkey(const char *path, PaillierKey &pk) {
+        FILE *fp = fopen(path, "w");
+        if (fp == NULL) {
+            return false;
+        }
+        gmp_fprintf(fp, "%d\n%Zx\n", pk.s, pk.n);
+        fclose(fp);
+        return true;
+    }
+
+    bool load_pubkey(const char *path, PaillierKey &pk) {
+        FILE *fp = fopen(path, "r");
+        if (fp == NULL) {
+            return false;
+        }
+        int s;
+        mpz_t n;
+        mpz_init(n);
+        bool ok = gmp_fscanf(fp, "%d %Zx", &s, n) == 2;
+        if (ok) {
+            pk = PaillierKey(n, s);
+        }
+        mpz_clear(n);
+        fclose(fp);
+        return ok;
+    }
+
+    /*The private key file is created readable by its owner only*/
+    bool save_prikey(const char *path, PaillierPrivateKey &sk) {
+        int fd = open(path, O_CREAT | O_WRONLY | O_TRUNC, 0600);
+        if (fd < 0) {
+            return false;
+        }
+        if (fchmod(fd, 0600) != 0) {       // an existing file keeps its mode otherwise
+            close(fd);
+            return false;
+        }
+        FILE *fp = fdopen(fd, "w");
+        if (fp == NULL) {
+            close(fd);
+            return false;
+        }
+        gmp_fprintf(fp, "%d\n%Zx\n%Zx\n", sk.s, sk.n, sk.lambda);
+        fclose(fp);
+        return true;
+    }
+
+    bool load_prikey(const char *path, PaillierPrivateKey &sk) {
+        FILE *fp = fopen(path, "r");
+        if (fp == NULL) {
+            return false;
+        }
+        int s;
+        mpz_t n, lambda;
+        mpz_inits(n, lambda, NULL);
+        bool ok = gmp_fscanf(fp, "%d %Zx %Zx", &s, n, lambda) == 3;
+        if (ok) {
+            sk = PaillierPrivateKey(n, lambda, s);
+        }
+        mpz_clears(n, lambda, NULL);
+        fclose(fp);
+        return ok;
+    }
+
+    /*Blocking FIFO with a fixed capacity, push() waits while it is full*/
+    template <class T>
+    class bqueue {
+
+    public:
+        bqueue(size_t cap) : cap(cap) {
+        }
+
+        void push(T v) {
+            unique_lock<mutex> lock(mtx);
+            not_full.wait(lock, [&] { return q.size() < cap || closed; });
+            q.push_back(std::move(v));
+            not_empty.notify_one();
+        }
+
+        /*Returns false once the queue is closed and drained*/
+        bool pop(T &v) {
+            unique_lock<mutex> lock(mtx);
+            not_empty.wait(lock, [&] { return !q.empty() || closed; });
+            if (q.empty()) {
+                return false;
+            }
+            v = std::move(q.front());
+            q.pop_front();
+            not_full.notify_one();
+            return true;
+        }
+
+        void close() {
+            lock_guard<mutex> lock(mtx);
+            closed = true;
+            not_empty.notify_all();
+            not_full.notify_all();
+        }
+
+    private:
+        size_t cap;
+        bool closed = false;
+        deque<T> q;
+        mutex mtx;
+        condition_variable not_empty, not_full;
+    };
+
+    /*
+    Bulk encryption for the data owner.
+    The input is parsed by one reader, encrypted by a pool of workers with
+    their own random states, and written in input order by one writer into
+    one ciphertext column file per input column. At most max_inflight
+    batches exist at any time, so memory does not grow with the input.
+    */
+    class ingest {
+
+    public:
+        Paillier pai;
+        int threads;                    // 0 in the constructor means get_num_threads()
+        int batch;                      // 0 in the constructor means tuned().batch
+        bool raw;                       // raw integer stream instead of CSV
+        long rows = 0, values = 0;
+        string error;
+
+        ingest(PaillierKey pubkey, int threads = 0, int batch = 0, bool raw = false)
+            : pai(pubkey), threads(threads > 0 ? threads : get_num_threads()), batch(batch > 0 ? batch : tuned(pubkey).batch), raw(raw) {
+        }
+
+        bool run(FILE *in, const char *out_prefix);
+        bool run(const char *in_path, const char *out_prefix);
+
+    private:
+        struct chunk {
+            long seq;
+            int cols;
+            vector<string> lines;       // CSV rows, or one integer per entry in raw mode
+            vector<vector<unsigned char> > out;
+        };
+
+        bool parse(mpz_t m, const char *tok);
+        void encrypt_chunk(chunk &ck, gmp_randstate_t st, size_t bytes);
+        void fail(const string &msg);
+        mutex err_mtx;
+        atomic<bool> failed{false};
+    };
+
+    void ingest::fail(const string &msg) {
+        lock_guard<mutex> lock(err_mtx);
+        if (!failed) {
+            error = msg;
+            failed = true;
+        }
+    }
+
+    /*Parse a signed integer and map it into Z_{n^s}*/
+    bool ingest::parse(mpz_t m, const char *tok) {
+        while (*tok == ' ' || *tok == '\t' || *tok == '\r') {
+            tok++;
+        }
+        string t(tok);
+        while (!t.empty() && (t.back() == ' ' || t.back() == '\t' || t.back() == '\r')) {
+            t.pop_back();
+        }
+        if (t.empty() || mpz_set_str(m, t[0] == '+' ? t.c_str() + 1 : t.c_str(), 10) != 0) {
+            return false;
+        }
+        if (mpz_sgn(m) < 0) {
+            mpz_neg(m, m);
+            if (mpz_cmp(m, pai.pubkey.half_n) > 0) {
+                return false;
+            }
+            mpz_sub(m, pai.pubkey.ns, m);
+        }
+        else if (mpz_cmp(m, pai.pubkey.half_n) > 0) {
+            return false;
+        }
+        return true;
+    }
+
+    void ingest::encrypt_chunk(chunk &ck, gmp_randstate_t st, size_t bytes) {
+        mpz_t m, c, r;
+        mpz_inits(m, c, r, NULL);
+        ck.out.assign(ck.cols, vector<unsigned char>());
+        for (int j = 0; j < ck.cols; j++) {
+            ck.out[j].resize(ck.lines.size() * bytes);
+        }
+        for (size_t i = 0; i < ck.lines.size() && !failed; i++) {
+            const char *p = ck.lines[i].c_str();
+            for (int j = 0; j < ck.cols; j++) {
+                const char *q = raw ? NULL : strchr(p, ',');
+                string tok(p, q != NULL ? q - p : strlen(p));
+                if ((q == NULL) != (j == ck.cols - 1) || !parse(m, tok.c_str())) {
+                    fail("bad value in row: " + ck.lines[i]);
+                    break;
+                }
+                mpz_urandomm(r, st, pai.pubkey.n);
+                pai.encrypt(c, m, r);
+                put_cipher(&ck.out[j][i * bytes], c, bytes);
+                p = q + 1;
+            }
+        }
+        mpz_clears(m, c, r, NULL);
+    }
+
+    bool ingest::run(FILE *in, const char *out_prefix) {
+        size_t bytes = cipher_bytes(pai.pubkey);
+        size_t max_inflight = 2 * threads + 2;
+        bqueue<chunk> todo(threads + 1);
+        bqueue<chunk> done(threads + 1);
+        vector<FILE *> files;
+        int cols = 0;
+
+        // writer: restores the input order and appends to the column files
+        mutex inflight_mtx;
+        condition_variable inflight_cv;
+        size_t inflight = 0;
+        thread writer([&] {
+            map<long, chunk> pending;
+            long next = 0;
+            chunk ck;
+            while (done.pop(ck)) {
+                pending[ck.seq] = std::move(ck);
+                while (!pending.empty() && pending.begin()->first == next) {
+                    chunk &w = pending.begin()->second;
+                    for (int j = 0; j < w.cols && !failed; j++) {
+                        if (fwrite(w.out[j].data(), 1, w.out[j].size(), files[j]) != w.out[j].size()) {
+                            fail("write error");
+                        }
+                    }
+                    pending.erase(pending.begin());
+                    next++;
+                    lock_guard<mutex> lock(inflight_mtx);
+                    inflight--;
+                    inflight_cv.notify_one();
+                }
+            }
+        });
+
+        // workers: one random state each, seeded from gmp_rand
+        vector<thread> workers;
+        mpz_t *seeds = new mpz_t[threads];
+        for (int t = 0; t < threads; t++) {
+            mpz_init(seeds[t]);
+            gmp_rand_mutex.lock();
+            mpz_urandomb(seeds[t], gmp_rand, 256);
+            gmp_rand_mutex.unlock();
+            workers.push_back(thread([&, t] {
+                gmp_randstate_t st;
+                gmp_randinit_default(st);
+                gmp_randseed(st, seeds[t]);
+                chunk ck;
+                while (todo.pop(ck)) {
+                    encrypt_chunk(ck, st, bytes);
+                    done.push(std::move(ck));
+                }
+                gmp_randclear(st);
+            }));
+        }
+
+        // reader
+        char *line = NULL;
+        size_t cap = 0;
+        ssize_t len;
+        long seq = 0;
+        bool first = true;
+        chunk ck;
+        while (!failed && (len = getline(&line, &cap, in)) != -1) {
+            while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')) {
+                line[--len] = '\0';
+            }
+            if (len == 0) {
+                continue;
+            }
+            if (first) {
+                // one column per CSV field, a non-numeric first line is a header
+                cols = raw ? 1 : 1 + count(line, line + len, ',');
+                for (int j = 0; j < cols; j++) {
+                    string path = string(out_prefix) + ".col" + to_string(j);
+                    FILE *fp = fopen(path.c_str(), "wb");
+                    if (fp == NULL) {
+                        fail("cannot open " + path);
+                        break;
+                    }
+                    files.push_back(fp);
+                }
+                first = false;
+                const char *p = line;
+                while (*p == ' ' || *p == '-' || *p == '+') {
+                    p++;
+                }
+                if (!raw && !(*p >= '0' && *p <= '9')) {
+                    continue;
+                }
+            }
+            if (raw) {
+                char *save = NULL;
+                for (char *tok = strtok_r(line, " \t,", &save); tok != NULL; tok = strtok_r(NULL, " \t,", &save)) {
+                    ck.lines.push_back(tok);
+                }
+            }
+            else {
+                ck.lines.push_back(line);
+            }
+            if ((int)ck.lines.size() >= batch) {
+                rows += ck.lines.size();
+                ck.cols = cols;
+                ck.seq = seq++;
+                {
+                    unique_lock<mutex> lock(inflight_mtx);
+                    inflight_cv.wait(lock, [&] { return inflight < max_inflight; });
+                    inflight++;
+                }
+                todo.push(std::move(ck));
+                ck = chunk();
+            }
+        }
+        if (!ck.lines.empty() && !failed) {
+            rows += ck.lines.size();
+            ck.cols = cols;
+            ck.seq = seq++;
+            {
+                lock_guard<mutex> lock(inflight_mtx);
+                inflight++;
+            }
+            todo.push(std::move(ck));
+        }
+        free(line);
+
+        todo.close();
+        for (int t = 0; t < threads; t++) {
+            workers[t].join();
+            mpz_clear(seeds[t]);
+        }
+        delete[] seeds;
+        done.close();
+        writer.join();
+        for (FILE *fp : files) {
+            fclose(fp);
+        }
+        values = rows * cols;
+        return !failed;
+    }
+
+    bool ingest::run(const char *in_path, const char *out_prefix) {
+        FILE *in = strcmp(in_path, "-") == 0 ? stdin : fopen(in_path, "r");
+        if (in == NULL) {
+            error = string("cannot open ") + in_path;
+            return false;
+        }
+        bool ok = run(in, out_prefix);
+        if (in != stdin) {
+            fclose(in);
+        }
+        return ok;
+    }
+}
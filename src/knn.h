@@ -0,0 +1,280 @@
+#pragma once
+
+#include "gmp.h"
+#include "paillier.h"
+#include "soci.h"
+
+using namespace phe;
+using namespace std;
+
+namespace soci {
+
+    /*
+    Encrypted k-nearest-neighbour search held by CP.
+    points holds n encrypted vectors of dim coordinates, row by row, labels
+    their n encrypted labels (NULL means the labels are the indices 0..n-1).
+    Squared distances must be less than 2^ell.
+    Nothing but n, dim and k is revealed to CP and CSP.
+    */
+    class knn {
+
+    public:
+        int n, dim, ell;
+        PaillierThd cp, csp;
+        seccomp sc;
+
+        knn(mpz_t *points, mpz_t *labels, int n, int dim, PaillierThd cp, PaillierThd csp, int ell = 32)
+            : n(n), dim(dim), ell(ell), cp(cp), csp(csp) {
+            this->points = new mpz_t[(long)n * dim];
+            this->labels = new mpz_t[n];
+            for (long i = 0; i < (long)n * dim; i++) {
+                mpz_init_set(this->points[i], points[i]);
+            }
+            mpz_t m;
+            mpz_init(m);
+            for (int i = 0; i < n; i++) {
+                if (labels != NULL) {
+                    mpz_init_set(this->labels[i], labels[i]);
+                }
+                else {
+                    mpz_init(this->labels[i]);
+                    mpz_set_ui(m, i);
+                    cp.pai.encrypt(this->labels[i], m);
+                }
+            }
+            mpz_clear(m);
+        }
+
+        knn(const knn &) = delete;
+        knn& operator=(const knn &) = delete;
+
+        ~knn() {
+            for (long i = 0; i < (long)n * dim; i++) {
+                mpz_clear(points[i]);
+            }
+            for (int i = 0; i < n; i++) {
+                mpz_clear(labels[i]);
+            }
+            delete[] points;
+            delete[] labels;
+        }
+
+        void distances(mpz_t *edist, mpz_t *eq);
+        void query(mpz_t *elabel, mpz_t *edist, mpz_t *eq, int k);
+
+    private:
+        mpz_t *points, *labels;
+
+        void cmpswap(mpz_t **cols, int ncols, const int *lo, const int *hi, int m);
+    };
+
+    /*
+    edist[i] = [||x_i - q||^2], one batched smul round over all n*dim coordinates.
+    [-q_j] is computed once per dimension, so each [x_ij - q_j] is a single add.
+    */
+    void knn::distances(mpz_t *edist, mpz_t *eq) {
+        long nd = (long)n * dim;
+        mpz_t *diff = new mpz_t[nd], *nq = new mpz_t[dim];
+        for (long i = 0; i < nd; i++) {
+            mpz_init(diff[i]);
+        }
+        for (int j = 0; j < dim; j++) {
+            mpz_init(nq[j]);
+        }
+        parallel_for(dim, [&](long j) {
+            cp.pai.scl_mul(nq[j], eq[j], sc.neg_one);       // [-q_j]
+        });
+        parallel_for(nd, [&](long i) {
+            cp.pai.add(diff[i], points[i], nq[i % dim]);    // [x_ij - q_j]
+        });
+        sc.smul(diff, diff, diff, nd, cp, csp);
+        parallel_for(n, [&](long i) {
+            mpz_set(edist[i], diff[i * dim]);
+            for (int j = 1; j < dim; j++) {
+                cp.pai.add(edist[i], edist[i], diff[i * dim + j]);
+            }
+        });
+        for (long i = 0; i < nd; i++) {
+            mpz_clear(diff[i]);
+        }
+        for (int j = 0; j < dim; j++) {
+            mpz_clear(nq[j]);
+        }
+        delete[] diff;
+        delete[] nq;
+    }
+
+    /*
+    Compare-exchange of the m disjoint record pairs (lo[t], hi[t]): afterwards
+    cols[0][lo[t]] <= cols[0][hi[t]], and the other ncols - 1 columns follow
+    their key. One batched scmp round and one batched smul round.
+    */
+    void knn::cmpswap(mpz_t **cols, int ncols, const int *lo, const int *hi, int m) {
+        long w = (long)m * ncols;
+        mpz_t *c = new mpz_t[m], *d = new mpz_t[w];
+        mpz_t *a = new mpz_t[m], *b = new mpz_t[m], *cv = new mpz_t[w];     // views
+        for (int t = 0; t < m; t++) {
+            mpz_init(c[t]);
+            view_of(a[t], cols[0][lo[t]]);
+            view_of(b[t], cols[0][hi[t]]);
+        }
+        for (long u = 0; u < w; u++) {
+            mpz_init(d[u]);
+        }
+        sc.scmp(c, a, b, m, cp, csp);                       // [x < y]
+        // d = [x < y] * (x - y), the smaller record is y + d and the larger x - d
+        parallel_for(w, [&](long u) {
+            int t = u % m;
+            mpz_t *col = cols[u / m];
+            cp.pai.scl_mul(d[u], col[hi[t]], sc.neg_one);
+            cp.pai.add(d[u], col[lo[t]], d[u]);
+            view_of(cv[u], c[t]);
+        });
+        sc.smul(d, cv, d, w, cp, csp);
+        parallel_for(w, [&](long u) {
+            int t = u % m;
+            mpz_t *col = cols[u / m];
+            cp.pai.add(col[hi[t]], col[hi[t]], d[u]);
+            cp.pai.scl_mul(d[u], d[u], sc.neg_one);
+            cp.pai.add(col[lo[t]], col[lo[t]], d[u]);
+            mpz_swap(col[lo[t]], col[hi[t]]);
+        });
+        for (int t = 0; t < m; t++) {
+            mpz_clear(c[t]);
+        }
+        for (long u = 0; u < w; u++) {
+            mpz_clear(d[u]);
+        }
+        delete[] c;
+        delete[] d;
+        delete[] a;
+        delete[] b;
+        delete[] cv;
+    }
+
+    /*
+    elabel[0..k) = encrypted labels of the k points nearest to q, nearest first.
+    edist, if not NULL, receives their encrypted squared distances.
+    Ties are broken by index: the selection runs on the unique keys d_i*n + i.
+    The points are padded with keys n*2^ell + i to blocks of K, the next power
+    of two >= k, and every block is sorted by a bitonic network. Pairs of
+    blocks are then merged until one is left: comparing A[i] with B[K-1-i]
+    keeps the K smallest of both in A, and log2 K layers sort A again. This
+    is O(n log^2 K) compare-exchanges in O(log^2 K + log(n/K) log K) rounds,
+    instead of k tournaments over all n points.
+    */
+    void knn::query(mpz_t *elabel, mpz_t *edist, mpz_t *eq, int k) {
+        if (k > n) {
+            throw("k must not exceed the number of points");
+        }
+        int K = 1;
+        while (K < k) {
+            K *= 2;
+        }
+        int blocks = (n + K - 1) / K;
+        long total = (long)blocks * K;
+        mpz_t *keys = new mpz_t[total], *lab = new mpz_t[total], *dist = new mpz_t[total];
+        for (long i = 0; i < total; i++) {
+            mpz_inits(keys[i], lab[i], dist[i], NULL);
+        }
+        mpz_t big, ni;
+        mpz_inits(big, ni, NULL);
+        mpz_set_ui(big, n);
+        mpz_mul_2exp(big, big, ell);
+        mpz_set_ui(ni, n);
+
+        distances(dist, eq);
+        parallel_for(total, [&](long i) {
+            mpz_t mi, ei;
+            mpz_init_set_ui(mi, i);
+            mpz_init(ei);
+            if (i < n) {
+                cp.pai.encrypt(ei, mi);
+                cp.pai.scl_mul(keys[i], dist[i], ni);
+                cp.pai.add(keys[i], keys[i], ei);          // [d_i*n + i]
+                mpz_set(lab[i], labels[i]);
+            }
+            else {
+                mpz_add(mi, mi, big);
+                cp.pai.encrypt(keys[i], mi);               // [n*2^ell + i], above every real key
+                mpz_set(lab[i], cp.ezero);
+                mpz_set(dist[i], cp.ezero);
+            }
+            mpz_clears(mi, ei, NULL);
+        });
+
+        int ncols = edist != NULL ? 3 : 2;
+        mpz_t *cols[3] = { keys, lab, dist };
+        vector<int> lo, hi;
+        // sort every block ascending, all blocks share each layer of the network
+        for (int size = 2; size <= K; size *= 2) {
+            for (int stride = size / 2; stride > 0; stride /= 2) {
+                lo.clear();
+                hi.clear();
+                for (int b = 0; b < blocks; b++) {
+                    for (int i = 0; i < K; i++) {
+                        int j = i ^ stride;
+                        if (j > i) {
+                            bool up = (i & size) == 0;
+                            lo.push_back(b * K + (up ? i : j));
+                            hi.push_back(b * K + (up ? j : i));
+                        }
+                    }
+                }
+                cmpswap(cols, ncols, lo.data(), hi.data(), lo.size());
+            }
+        }
+        // merge pairs of blocks, the odd one out moves up a level
+        vector<int> live(blocks);
+        for (int b = 0; b < blocks; b++) {
+            live[b] = b * K;
+        }
+        while (live.size() > 1) {
+            int pairs = live.size() / 2;
+            lo.clear();
+            hi.clear();
+            for (int p = 0; p < pairs; p++) {
+                for (int i = 0; i < K; i++) {
+                    lo.push_back(live[2 * p] + i);
+                    hi.push_back(live[2 * p + 1] + K - 1 - i);
+                }
+            }
+            cmpswap(cols, ncols, lo.data(), hi.data(), lo.size());
+            for (int stride = K / 2; stride > 0; stride /= 2) {
+                lo.clear();
+                hi.clear();
+                for (int p = 0; p < pairs; p++) {
+                    for (int i = 0; i < K; i++) {
+                        if ((i ^ stride) > i) {
+                            lo.push_back(live[2 * p] + i);
+                            hi.push_back(live[2 * p] + (i ^ stride));
+                        }
+                    }
+                }
+                cmpswap(cols, ncols, lo.data(), hi.data(), lo.size());
+            }
+            vector<int> next;
+            for (int p = 0; p < pairs; p++) {
+                next.push_back(live[2 * p]);
+            }
+            if (live.size() % 2 == 1) {
+                next.push_back(live.back());
+            }
+            live.swap(next);
+        }
+        for (int t = 0; t < k; t++) {
+            mpz_set(elabel[t], lab[live[0] + t]);
+            if (edist != NULL) {
+                mpz_set(edist[t], dist[live[0] + t]);
+            }
+        }
+
+        mpz_clears(big, ni, NULL);
+        for (long i = 0; i < total; i++) {
+            mpz_clears(keys[i], lab[i], dist[i], NULL);
+        }
+        delete[] keys;
+        delete[] lab;
+        delete[] dist;
+    }
+}
@@ -0,0 +1,228 @@
+#pragma once
+
+#include <vector>
+#include "gmp.h"
+#include "paillier.h"
+#include "soci.h"
+#include "tune.h"
+
+using namespace phe;
+using namespace std;
+
+namespace soci {
+
+    /*
+    Layer-level operators for neural-network inference on encrypted
+    fixed-point values, held by CP. Every operator works on a whole layer,
+    or a batch of layers stored row by row, so all activations share the
+    rounds of one batched protocol call. window is the width of the dense
+    tables, 0 means the tuned width (see tune.h).
+    */
+    class nn {
+
+    public:
+        PaillierThd cp, csp;
+        seccomp sc;
+        int window;
+
+        nn(PaillierThd cp, PaillierThd csp, int window = 0) : cp(cp), csp(csp), window(window > 0 ? window : tuned(cp.pai.pubkey).nn_window) {
+            mpz_init(this->inv2);
+            mpz_set_ui(this->inv2, 2);
+            mpz_invert(this->inv2, this->inv2, cp.pai.pubkey.ns);
+        }
+
+        nn(const nn &) = delete;
+        nn& operator=(const nn &) = delete;
+
+        ~nn() {
+            mpz_clear(inv2);
+        }
+
+        void dense(mpz_t *out, mpz_t *in, int batch, int n_in, int n_out, const long *w, const long *b);
+        void relu(mpz_t *out, mpz_t *in, int n, bool halve = true);
+        void maxpool(mpz_t *out, mpz_t *in, int n, int k);
+        void rescale(mpz_t *out, mpz_t *in, int n, int frac, int ell);
+
+    private:
+        mpz_t inv2;     // 1/2 mod N^s
+
+        /*|w| without overflow for LONG_MIN*/
+        static unsigned long mag(long w) { return w < 0 ? 0UL - (unsigned long)w : (unsigned long)w; }
+    };
+
+    /*
+    out[r*n_out + j] = [sum_i w[j*n_in + i] * x_ri + b[j]] for every row r of
+    the batch, b may be NULL. One multi-exponentiation (Straus) per output:
+    the tables x_ri^d for d < 2^window are built once per input and shared
+    by all n_out neurons, then every neuron walks the window digits of its
+    weights with one squaring chain. Negative weights go to a second
+    accumulator that is inverted at the end. An output whose weights are
+    all zero is a fresh encryption of its bias, not the trivial [0] = 1.
+    */
+    void nn::dense(mpz_t *out, mpz_t *in, int batch, int n_in, int n_out, const long *w, const long *b) {
+        int d = 1 << window;
+        mpz_t &nsq = cp.pai.pubkey.nsquare;
+        unsigned long maxw = 0;
+        for (long i = 0; i < (long)n_in * n_out; i++) {
+            maxw = mag(w[i]) > maxw ? mag(w[i]) : maxw;
+        }
+        int bits = 0;
+        while (bits < 64 && (maxw >> bits) != 0) {
+            bits++;
+        }
+        int digits = (bits + window - 1) / window;
+
+        // tables, slot (i << window) + e holds x_i^e
+        long n = (long)batch * n_in;
+        CipherVector tab(cp.pai.pubkey, n << window);
+        parallel_for(n, [&](long i) {
+            mpz_t x;
+            mpz_init_set_ui(x, 1);
+            tab.set(i << window, x);
+            for (int e = 1; e < d; e++) {
+                mpz_mul(x, x, in[i]);
+                mpz_mod(x, x, nsq);
+                tab.set((i << window) + e, x);
+            }
+            mpz_clear(x);
+        });
+
+        parallel_for((long)batch * n_out, [&](long t) {
+            long r = t / n_out, j = t % n_out;
+            const long *wj = w + j * n_in;
+            mpz_t pos, neg, v, c;
+            mpz_init_set_ui(pos, 1);
+            mpz_init_set_ui(neg, 1);
+            mpz_init(c);
+            bool any = false;
+            for (int k = digits - 1; k >= 0; k--) {
+                if (k < digits - 1) {
+                    for (int s = 0; s < window; s++) {
+                        mpz_mul(pos, pos, pos);
+                        mpz_mod(pos, pos, nsq);
+                        mpz_mul(neg, neg, neg);
+                        mpz_mod(neg, neg, nsq);
+                    }
+                }
+                for (int i = 0; i < n_in; i++) {
+                    int e = (mag(wj[i]) >> (k * window)) & (d - 1);
+                    if (e == 0) {
+                        continue;
+                    }
+                    any = true;
+                    mpz_ptr acc = wj[i] > 0 ? pos : neg;
+                    mpz_mul(acc, acc, tab.view(v, ((r * n_in + i) << window) + e));
+                    mpz_mod(acc, acc, nsq);
+                }
+            }
+            if (any) {
+                mpz_invert(neg, neg, nsq);
+                mpz_mul(pos, pos, neg);
+                mpz_mod(out[t], pos, nsq);
+            }
+            else {
+                mpz_set_ui(c, 0);
+                cp.pai.encrypt(out[t], c);
+            }
+            if (b != NULL && b[j] != 0) {
+                mpz_set_si(c, b[j]);
+                cp.pai.scl_mul(c, cp.eone, c);
+                cp.pai.add(out[t], out[t], c);
+            }
+            mpz_clears(pos, neg, c, NULL);
+        });
+    }
+
+    /*
+    out[i] = [max(x_i, 0)] = [(x_i + |x_i|) / 2], one batched fssba round.
+    With halve == false out[i] = [2 * max(x_i, 0)], which saves the
+    exponentiation by 1/2 when a rescale follows anyway.
+    */
+    void nn::relu(mpz_t *out, mpz_t *in, int n, bool halve) {
+        mpz_t *s = new mpz_t[n], *u = new mpz_t[n];
+        for (int i = 0; i < n; i++) {
+            mpz_inits(s[i], u[i], NULL);
+        }
+        sc.fssba(s, u, in, n, cp, csp);             // u = [|x|]
+        parallel_for(n, [&](int i) {
+            cp.pai.add(out[i], in[i], u[i]);
+            if (halve) {
+                cp.pai.scl_mul(out[i], out[i], inv2);
+            }
+        });
+        for (int i = 0; i < n; i++) {
+            mpz_clears(s[i], u[i], NULL);
+        }
+        delete[] s;
+        delete[] u;
+    }
+
+    /*
+    out[g] = [max(x_gk, ..., x_gk+k-1)] for the n/k groups of k consecutive
+    values. Tournament over all groups at once with
+    2*max(a, b) = a + b + |a - b|, one batched fssba round per level. The
+    factors of 2 are carried along and removed by one exponentiation at the end.
+    */
+    void nn::maxpool(mpz_t *out, mpz_t *in, int n, int k) {
+        int groups = n / k;
+        mpz_t *cur = new mpz_t[n], *diff = new mpz_t[n / 2 + 1], *s = new mpz_t[n / 2 + 1], *u = new mpz_t[n / 2 + 1];
+        for (int i = 0; i < n; i++) {
+            mpz_init_set(cur[i], in[i]);
+        }
+        for (int i = 0; i <= n / 2; i++) {
+            mpz_inits(diff[i], s[i], u[i], NULL);
+        }
+        int levels = 0;
+        for (int m = k; m > 1; m = (m + 1) / 2, levels++) {
+            int h = m / 2;
+            parallel_for((long)groups * h, [&](long t) {
+                long a = t / h * k + 2 * (t % h);
+                cp.pai.scl_mul(diff[t], cur[a + 1], sc.neg_one);
+                cp.pai.add(diff[t], cur[a], diff[t]);       // [a - b]
+            });
+            sc.fssba(s, u, diff, groups * h, cp, csp);      // [|a - b|]
+            parallel_for((long)groups * h, [&](long t) {
+                long a = t / h * k + 2 * (t % h);
+                cp.pai.add(cur[a], cur[a], cur[a + 1]);
+                cp.pai.add(cur[a], cur[a], u[t]);           // [2 * max(a, b)]
+            });
+            // compact the winners to the front of each group, the odd one out is doubled too
+            for (int g = 0; g < groups; g++) {
+                mpz_t *c = cur + (long)g * k;
+                for (int i = 1; i < h; i++) {
+                    mpz_swap(c[i], c[2 * i]);
+                }
+                if (m % 2 == 1) {
+                    cp.pai.add(c[h], c[m - 1], c[m - 1]);
+                }
+            }
+        }
+        mpz_t inv;
+        mpz_init(inv);
+        mpz_powm_ui(inv, inv2, levels, cp.pai.pubkey.ns);
+        parallel_for(groups, [&](int g) {
+            if (levels > 0) {
+                cp.pai.scl_mul(out[g], cur[(long)g * k], inv);
+            }
+            else {
+                mpz_set(out[g], cur[(long)g * k]);
+            }
+        });
+        mpz_clear(inv);
+        for (int i = 0; i < n; i++) {
+            mpz_clear(cur[i]);
+        }
+        for (int i = 0; i <= n / 2; i++) {
+            mpz_clears(diff[i], s[i], u[i], NULL);
+        }
+        delete[] cur;
+        delete[] diff;
+        delete[] s;
+        delete[] u;
+    }
+
+    /*Fixed-point rescaling out[i] = [floor(x_i / 2^frac)] for |x_i| < 2^ell, one batched strunc*/
+    void nn::rescale(mpz_t *out, mpz_t *in, int n, int frac, int ell) {
+        sc.strunc(out, in, n, frac, ell, cp, csp);
+    }
+}
@@ -1,82 +1,99 @@
 #pragma once
 #include <stdio.h>
+#include <mutex>
 #include "gmp.h"
 
 
 extern gmp_randstate_t gmp_rand;
 gmp_randstate_t gmp_rand;
+std::mutex gmp_rand_mutex;	// gmp_rand is shared by the worker threads of batched protocols
 
 namespace phe {
 
-	const int sigma = 128;
+	const int sigma = 128;	// statistical security parameter of the masks, never tuned
 
+	/*
+	Damgård–Jurik generalisation: with s > 1 the plaintext space is Z_{n^s} and
+	ciphertexts live in Z_{n^(s+1)}. s = 1 is the original Paillier scheme.
+	For brevity the ciphertext modulus is still called nsquare.
+	*/
 	class PaillierKey {
 
 	public:
-		mpz_t g, n, nsquare, half_n;
+		int s;
+		mpz_t g, n, ns, nsquare, half_n;	// ns = n^s, nsquare = n^(s+1), half_n = n^s / 2
 
 		PaillierKey() {
-			mpz_inits(this->g, this->n, this->nsquare, this->half_n, NULL);
+			this->s = 1;
+			mpz_inits(this->g, this->n, this->ns, this->nsquare, this->half_n, NULL);
 		}
 
 		PaillierKey(mpz_t p, mpz_t q) {
-			mpz_t two;
-			mpz_inits(this->g, this->n, this->nsquare, this->half_n, two, NULL);
+			mpz_t n;
+			mpz_init(n);
+			mpz_inits(this->g, this->n, this->ns, this->nsquare, this->half_n, NULL);
 
-			mpz_mul(this->n, p, q);		// n = p * q
-			mpz_add_ui(this->g, this->n, 1);	// g = n + 1
-			mpz_mul(this->nsquare, this->n, this->n); // nsqaure = n * n
-			mpz_set_ui(two, 2);
-			mpz_fdiv_q(this->half_n, this->n, two);	  // half_n = n / 2	
-			mpz_clear(two);
+			mpz_mul(n, p, q);		// n = p * q
+			init(n, 1);
+			mpz_clear(n);
 		}
 
-		PaillierKey(mpz_t n) {
-			mpz_t two;
-			mpz_inits(this->g, this->n, this->nsquare, this->half_n, two, NULL);
+		PaillierKey(mpz_t n, int s = 1) {
+			mpz_inits(this->g, this->n, this->ns, this->nsquare, this->half_n, NULL);
 
-			mpz_set(this->n, n);
-			mpz_add_ui(this->g, this->n, 1);	// g = n + 1;
-			mpz_mul(this->nsquare, this->n, this->n); // nsqaure = n * n;
-			mpz_set_ui(two, 2);
-			mpz_fdiv_q(this->half_n, this->n, two);	  // half_n = n / 2	
-			mpz_clear(two);
+			init(n, s);
 		}
 
 		PaillierKey(mpz_t g, mpz_t n, mpz_t nsqaure) {
-			mpz_t two;
-			mpz_inits(this->g, this->n, this->nsquare, this->half_n, two, NULL);
-
+			mpz_inits(this->g, this->n, this->ns, this->nsquare, this->half_n, NULL);
+
+			// recover s from nsquare = n^(s+1)
+			int s = 0;
+			mpz_set(this->ns, nsqaure);
+			while (mpz_cmp(this->ns, n) > 0) {
+				mpz_divexact(this->ns, this->ns, n);
+				s++;
+			}
+			init(n, s);
 			mpz_set(this->g, g);
-			mpz_set(this->n, n);
-			mpz_set(this->nsquare, nsqaure);
-			mpz_set_ui(two, 2);
-			mpz_fdiv_q(this->half_n, this->n, two);	  // half_n = n / 2	
-			mpz_clear(two);
 		}
 
 		PaillierKey(const PaillierKey &p) {
-			mpz_inits(this->g, this->n, this->nsquare, this->half_n, NULL);
+			mpz_inits(this->g, this->n, this->ns, this->nsquare, this->half_n, NULL);
 
+			this->s = p.s;
 			mpz_set(this->n, p.n);
 			mpz_set(this->g, p.g);
+			mpz_set(this->ns, p.ns);
 			mpz_set(this->nsquare, p.nsquare);
 			mpz_set(this->half_n, p.half_n);
 		}
 
 		PaillierKey& operator=(const PaillierKey& p) {
-			mpz_clears(this->g, this->n, this->nsquare, this->half_n, NULL);
-			mpz_inits(this->g, this->n, this->nsquare, this->half_n, NULL);
+			mpz_clears(this->g, this->n, this->ns, this->nsquare, this->half_n, NULL);
+			mpz_inits(this->g, this->n, this->ns, this->nsquare, this->half_n, NULL);
 
+			this->s = p.s;
 			mpz_set(this->n, p.n);
 			mpz_set(this->g, p.g);
+			mpz_set(this->ns, p.ns);
 			mpz_set(this->nsquare, p.nsquare);
 			mpz_set(this->half_n, p.half_n);
 			return *this;
 		}
 		
 		~PaillierKey() {
-			mpz_clears(this->g,this->n,this->nsquare,this->half_n, NULL);
+			mpz_clears(this->g, this->n, this->ns, this->nsquare, this->half_n, NULL);
+		}
+
+	private:
+		void init(mpz_t n, int s) {
+			this->s = s;
+			mpz_set(this->n, n);
+			mpz_add_ui(this->g, this->n, 1);		// g = n + 1
+			mpz_pow_ui(this->ns, this->n, s);		// ns = n^s
+			mpz_mul(this->nsquare, this->ns, this->n);	// nsquare = n^(s+1)
+			mpz_fdiv_q_2exp(this->half_n, this->ns, 1);	// half_n = n^s / 2
 		}
 	};
 
@@ -93,14 +110,14 @@ namespace phe {
 			mpz_inits(this->lambda, this->lmdInv, NULL);
 
 			mpz_set(this->lambda, lambda);
-			mpz_invert(this->lmdInv, this->lambda, this->n);
+			mpz_invert(this->lmdInv, this->lambda, this->ns);
 		}
 
-		PaillierPrivateKey(mpz_t n, mpz_t lambda) : PaillierKey(n) {
+		PaillierPrivateKey(mpz_t n, mpz_t lambda, int s = 1) : PaillierKey(n, s) {
 			mpz_inits(this->lambda, this->lmdInv, NULL);
 
 			mpz_set(this->lambda, lambda);
-			mpz_invert(this->lmdInv, this->lambda, this->n);
+			mpz_invert(this->lmdInv, this->lambda, this->ns);	// lmdInv = lambda^(-1) mod n^s
 		}
 
 		PaillierPrivateKey(const PaillierPrivateKey &p) : PaillierKey(p){
@@ -131,15 +148,18 @@ namespace phe {
 	class PaillierThdPrivateKey {
 
 	public:
+		int s;
 		mpz_t sk, n, nsqaure;
 
 		PaillierThdPrivateKey() {
+			this->s = 1;
 			mpz_inits(this->sk, this->n, this->nsqaure, NULL);
 		}
 
-		PaillierThdPrivateKey(mpz_t sk, mpz_t n, mpz_t nsqaure) {
+		PaillierThdPrivateKey(mpz_t sk, mpz_t n, mpz_t nsqaure, int s = 1) {
 			mpz_inits(this->sk, this->n, this->nsqaure, NULL);
 
+			this->s = s;
 			mpz_set(this->sk, sk);
 			mpz_set(this->n, n);
 			mpz_set(this->nsqaure, nsqaure);
@@ -148,6 +168,7 @@ namespace phe {
 		PaillierThdPrivateKey(const PaillierThdPrivateKey &p) {
 			mpz_inits(this->sk, this->n, this->nsqaure, NULL);
 
+			this->s = p.s;
 			mpz_set(this->sk, p.sk);
 			mpz_set(this->n, p.n);
 			mpz_set(this->nsqaure, p.nsqaure);
@@ -157,6 +178,7 @@ namespace phe {
 			mpz_clears(this->sk, this->n, this->nsqaure, NULL);
 			mpz_inits(this->sk, this->n, this->nsqaure, NULL);
 
+			this->s = p.s;
 			mpz_set(this->sk, p.sk);
 			mpz_set(this->n, p.n);
 			mpz_set(this->nsqaure, p.nsqaure);
@@ -169,11 +191,21 @@ namespace phe {
 
 	};
 
+	/*Exponentiation c^e mod n^(s+1) used by scl_mul when attached, see fbcache.h*/
+	class powm_cache {
+
+	public:
+		virtual void powm(mpz_t res, const mpz_t c, const mpz_t e) = 0;
+		virtual ~powm_cache() {
+		}
+	};
+
 	class Paillier {
 
 	public:
 		PaillierKey pubkey;
 		PaillierPrivateKey prikey;
+		powm_cache *cache = NULL;	// opt-in, must be built for pubkey
 
 		Paillier() {
 		}
@@ -183,7 +215,7 @@ namespace phe {
 		}
 
 		Paillier(PaillierPrivateKey prikey) {
-			this->pubkey = PaillierKey(prikey.g, prikey.n, prikey.nsquare);
+			this->pubkey = prikey;
 			this->prikey = prikey;
 			
 		}
@@ -196,11 +228,13 @@ namespace phe {
 		Paillier(const Paillier &p) {
 			this->pubkey = p.pubkey;
 			this->prikey = p.prikey;
+			this->cache = p.cache;
 		}
 
 		Paillier& operator=(const Paillier& p) {
 			this->pubkey = p.pubkey;
 			this->prikey = p.prikey;
+			this->cache = p.cache;
 			return *this;
 		}
 		
@@ -208,14 +242,14 @@ namespace phe {
 		~Paillier() {
 		}
 
-		void keygen(mpz_t p, mpz_t q);
-		void keygen(unsigned long bitLen);
-		void encrypt(mpz_t c, mpz_t m);
-		void encrypt(mpz_t c, mpz_t m, mpz_t r);
-		void decrypt(mpz_t m, mpz_t c);
-		void add(mpz_t res, mpz_t c1, mpz_t c2);
-		void scl_mul(mpz_t resc, mpz_t c, mpz_t e);
-		void scl_mul(mpz_t res, mpz_t c, int e);
+		void keygen(mpz_t p, mpz_t q, int s = 1);
+		void keygen(unsigned long bitLen, int s = 1);
+		void encrypt(mpz_t c, const mpz_t m);
+		void encrypt(mpz_t c, const mpz_t m, mpz_t r);
+		void decrypt(mpz_t m, const mpz_t c);
+		void add(mpz_t res, const mpz_t c1, const mpz_t c2);
+		void scl_mul(mpz_t resc, const mpz_t c, const mpz_t e);
+		void scl_mul(mpz_t res, const mpz_t c, int e);
 
 		};
 
@@ -266,8 +300,8 @@ namespace phe {
 		~PaillierThd() {
 			mpz_clears(ezero, eone, NULL);
 		};
-		void pdec(mpz_t pc, mpz_t c);
-		void fdec(mpz_t m, mpz_t c1, mpz_t c2);
+		void pdec(mpz_t pc, const mpz_t c);
+		void fdec(mpz_t m, const mpz_t c1, const mpz_t c2);
 	};
 
 	void setrandom() {
@@ -275,7 +309,7 @@ namespace phe {
 		gmp_randinit_default(gmp_rand);
 	}
 
-	void Paillier::keygen(unsigned long bitLen) {
+	void Paillier::keygen(unsigned long bitLen, int s) {
 
 		mpz_t r, p, q, pp, qq, quotient,remainder;
 		mpz_inits(r, p, q, pp, qq, quotient,remainder, NULL);
@@ -319,12 +353,12 @@ namespace phe {
 
 
 		}
-		keygen(p, q);
+		keygen(p, q, s);
 
 		mpz_clears(r, p, q, pp, qq, quotient,remainder, NULL);
 	}
 	/*
-	void Paillier::keygen(unsigned long bitLen) {
+	void Paillier::keygen(unsigned long bitLen, int s) {
 
 		mpz_t p, q;
 		mpz_inits(p, q, NULL);
@@ -337,18 +371,18 @@ namespace phe {
 		mpz_clears(p, q, NULL);
 	}*/
 
-	void Paillier::keygen(mpz_t p, mpz_t q) {
+	void Paillier::keygen(mpz_t p, mpz_t q, int s) {
 
 		mpz_t n, lambda;
 		mpz_inits(n, lambda, NULL);
 
 		mpz_mul(n, p, q);
-		pubkey = PaillierKey(n);
+		pubkey = PaillierKey(n, s);
 		mpz_sub_ui(p, p, 1);
 		mpz_sub_ui(q, q, 1);
 		mpz_mul(lambda, p, q);
 
-		prikey = PaillierPrivateKey(n, lambda);
+		prikey = PaillierPrivateKey(n, lambda, s);
 
 		mpz_clears(n, lambda, NULL);
 	}
@@ -388,17 +422,19 @@ namespace phe {
 		mpz_clears(r, m1, NULL);
 	}*/
 
-	void Paillier::encrypt(mpz_t c, mpz_t m) {
+	void Paillier::encrypt(mpz_t c, const mpz_t m) {
 
-		if (mpz_cmp(m, pubkey.n) >= 0) {
+		if (mpz_cmp(m, pubkey.ns) >= 0) {
 
-			throw("m must be less than n");
+			throw("m must be less than n^s");
 			return;
 		}
 
 		mpz_t r;
 		mpz_init(r);
+		gmp_rand_mutex.lock();
 		mpz_urandomm(r, gmp_rand, pubkey.n);
+		gmp_rand_mutex.unlock();
 		encrypt(c, m, r);
 		mpz_clears(r, NULL);
 	}
@@ -439,14 +475,14 @@ namespace phe {
 		mpz_mod(c, c, pubkey.nsquare);
 	}*/
 
-	void Paillier::encrypt(mpz_t c, mpz_t m, mpz_t r) {
+	void Paillier::encrypt(mpz_t c, const mpz_t m, mpz_t r) {
 
-		if (mpz_cmp(m, pubkey.n) >= 0) {
-			throw("m must be less than n");
+		if (mpz_cmp(m, pubkey.ns) >= 0) {
+			throw("m must be less than n^s");
 			return;
 		}
 
-		// g^m * r^n mod n^2
+		// g^m * r^(n^s) mod n^(s+1)
 		/*mpz_mul(c, m, puk.e1);			 // m·n
 		mpz_add_ui(c, c, 1);			 // 1 + m·n
 		mpz_powm(r, r, puk.e1, puk.e3);  // r^n mod n^2
@@ -454,14 +490,14 @@ namespace phe {
 		mpz_mod(c, c, puk.e3);			 // (1+m·N)·r^n mod n^2
 		*/
 		mpz_powm(c, pubkey.g, m, pubkey.nsquare);
-		mpz_powm(r, r, pubkey.n, pubkey.nsquare);
+		mpz_powm(r, r, pubkey.ns, pubkey.nsquare);
 		mpz_mul(c, c, r);
 		mpz_mod(c, c, pubkey.nsquare);
 	}
 	/*
 	void Paillier::decrypt(mpz_t m, mpz_t c) {
 		if (mpz_cmp(c, prikey.nsquare) >= 0) {
-			throw("ciphertext must be less than n^2");
+			throw("ciphertext must be less than n^(s+1)");
 			return;
 		}
 
@@ -480,50 +516,97 @@ namespace phe {
 		}
 	}
 	*/
-	void Paillier::decrypt(mpz_t m, mpz_t c) {
+
+	/*
+	Given a = (1+n)^i mod n^(s+1), recover i mod n^s.
+	For s = 1 this is L(a) = (a-1)/n, otherwise the Damgård–Jurik algorithm.
+	*/
+	void dj_log(mpz_t i, const mpz_t a, const mpz_t n, int s) {
+
+		if (s == 1) {
+			mpz_sub_ui(i, a, 1);
+			mpz_fdiv_q(i, i, n);
+			return;
+		}
+
+		mpz_t t1, t2, nj, nk, kfact, tmp, a1;
+		mpz_inits(t1, t2, nj, nk, kfact, tmp, NULL);
+		mpz_init_set(a1, a);	// i and a may be the same variable
+		mpz_set_ui(i, 0);
+		mpz_set(nj, n);
+		for (int j = 1; j <= s; j++) {
+			mpz_mul(tmp, nj, n);
+			mpz_mod(t1, a1, tmp);			// a mod n^(j+1)
+			mpz_sub_ui(t1, t1, 1);
+			mpz_fdiv_q(t1, t1, n);			// t1 = L(a mod n^(j+1))
+			mpz_set(t2, i);
+			mpz_set_ui(nk, 1);
+			mpz_set_ui(kfact, 1);
+			for (int k = 2; k <= j; k++) {
+				mpz_sub_ui(i, i, 1);
+				mpz_mul(t2, t2, i);
+				mpz_mod(t2, t2, nj);
+				mpz_mul(nk, nk, n);		// n^(k-1)
+				mpz_mul_ui(kfact, kfact, k);	// k!
+				mpz_invert(tmp, kfact, nj);
+				mpz_mul(tmp, tmp, t2);
+				mpz_mul(tmp, tmp, nk);
+				mpz_sub(t1, t1, tmp);		// t1 = t1 - t2 * n^(k-1) / k!
+				mpz_mod(t1, t1, nj);
+			}
+			mpz_set(i, t1);
+			mpz_mul(nj, nj, n);
+		}
+		mpz_clears(t1, t2, nj, nk, kfact, tmp, a1, NULL);
+	}
+
+	void Paillier::decrypt(mpz_t m, const mpz_t c) {
 		if (mpz_cmp(c, prikey.nsquare) >= 0) {
-			throw("ciphertext must be less than n^2");
+			throw("ciphertext must be less than n^(s+1)");
 			return;
 		}
 
-		// c=c^lambda mod n^2
+		// c=c^lambda mod n^(s+1)
 		
 		mpz_powm(m, c, prikey.lambda, prikey.nsquare);
 
-		// (c - 1) / n * lambda^(-1) mod n
-		mpz_sub_ui(m, m, 1);			// c=c-1
-		mpz_fdiv_q(m, m, prikey.n);		// c=(c-1)/n
+		// log_(1+n)(c) * lambda^(-1) mod n^s
+		dj_log(m, m, prikey.n, prikey.s);	// c=L(c)
 		mpz_mul(m, m, prikey.lmdInv);	// c=c*lambda^(-1)
-		mpz_mod(m, m, prikey.n);		// m=c mod n
+		mpz_mod(m, m, prikey.ns);		// m=c mod n^s
 	}
 
-	void Paillier::add(mpz_t res, mpz_t c1, mpz_t c2) {
+	void Paillier::add(mpz_t res, const mpz_t c1, const mpz_t c2) {
 
 		if (mpz_cmp(c1, pubkey.nsquare) >= 0) {
-			throw("ciphertext must be less than n^2");
+			throw("ciphertext must be less than n^(s+1)");
 			return;
 		}
 		if (mpz_cmp(c2, pubkey.nsquare) >= 0) {
-			throw("ciphertext must be less than n^2");
+			throw("ciphertext must be less than n^(s+1)");
 			return;
 		}
 		mpz_mul(res, c1, c2);
 		mpz_mod(res, res, pubkey.nsquare);
 	}
 
-	void Paillier::scl_mul(mpz_t res, mpz_t c, mpz_t e) {
+	void Paillier::scl_mul(mpz_t res, const mpz_t c, const mpz_t e) {
 
 		if (mpz_cmp(c, pubkey.nsquare) >= 0) {
-			throw("ciphertext must be less than n^2");
+			throw("ciphertext must be less than n^(s+1)");
 			return;
 		}
-		if (mpz_cmp(e, pubkey.n) >= 0) {
-			throw("exponent must be less than n");
+		if (mpz_cmp(e, pubkey.ns) >= 0) {
+			throw("exponent must be less than n^s");
+		}
+		if (cache != NULL) {
+			cache->powm(res, c, e);
+			return;
 		}
 		mpz_powm(res, c, e, pubkey.nsquare);
 	}
 
-	void Paillier::scl_mul(mpz_t res, mpz_t c, int e) {
+	void Paillier::scl_mul(mpz_t res, const mpz_t c, int e) {
 
 		mpz_t mp_e;
 		mpz_init(mp_e);
@@ -532,18 +615,17 @@ namespace phe {
 		mpz_clears(mp_e, NULL);
 	}
 
-	void PaillierThd::pdec(mpz_t pc, mpz_t c) {
-		// c^sk % n^2
+	void PaillierThd::pdec(mpz_t pc, const mpz_t c) {
+		// c^sk % n^(s+1)
 		mpz_powm(pc, c, psk.sk, psk.nsqaure);
 	}
 
-	void PaillierThd::fdec(mpz_t m, mpz_t c1, mpz_t c2) {
+	void PaillierThd::fdec(mpz_t m, const mpz_t c1, const mpz_t c2) {
 
-		// (c1 * c2 % n^2 - 1)/n
+		// L(c1 * c2 % n^(s+1)), which is (c1 * c2 % n^2 - 1)/n for s = 1
 		mpz_mul(m, c1, c2);
 		mpz_mod(m, m, psk.nsqaure);
-		mpz_sub_ui(m, m, 1);
-		mpz_fdiv_q(m, m, psk.n);
+		dj_log(m, m, psk.n, psk.s);
 	}
 
 	class ThirdKeyGen {
@@ -560,13 +642,13 @@ namespace phe {
 
 		mpz_rrandomb(sk1, gmp_rand, sigma);	// sk1 is a ranodm number with sigma bits
 		mpz_mul(sk2, pai.prikey.lambda, pai.prikey.lmdInv);
-		mpz_sub(sk2, sk2, sk1);				// sk2 = lambda · mu - sk1
+		mpz_sub(sk2, sk2, sk1);				// sk2 = lambda · mu - sk1, mu = lambda^(-1) mod n^s
 		PaillierThdPrivateKey* tmpPSK = NULL;
-		tmpPSK = new PaillierThdPrivateKey(sk1, pai.prikey.n, pai.prikey.nsquare);
+		tmpPSK = new PaillierThdPrivateKey(sk1, pai.prikey.n, pai.prikey.nsquare, pai.prikey.s);
 		*cp = PaillierThd(*tmpPSK, pai.pubkey);
 		delete tmpPSK;
 
-		tmpPSK = new PaillierThdPrivateKey(sk2, pai.prikey.n, pai.prikey.nsquare);
+		tmpPSK = new PaillierThdPrivateKey(sk2, pai.prikey.n, pai.prikey.nsquare, pai.prikey.s);
 		*csp = PaillierThd(*tmpPSK, pai.pubkey);
 		delete tmpPSK;
 
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <thread>
+#include <vector>
+#include <atomic>
+#include <exception>
+
+namespace soci {
+
+    /*
+    Number of worker threads used by the batched protocols and operators.
+    0 means the count given by thread_source, or one thread per hardware
+    core if that is unset or returns 0.
+    */
+    int num_threads = 0;
+
+    /*Default thread count, installed with set_thread_source (tune.h installs the tuned count)*/
+    int (*thread_source)() = NULL;
+
+    thread_local bool in_worker = false;
+
+    void set_thread_source(int (*f)()) {
+        thread_source = f;
+    }
+
+    int get_num_threads() {
+        if (num_threads > 0) {
+            return num_threads;
+        }
+        int t = thread_source != NULL ? thread_source() : 0;
+        if (t > 0) {
+            return t;
+        }
+        int hc = std::thread::hardware_concurrency();
+        return hc > 0 ? hc : 1;
+    }
+
+    /*
+    Run f(0), ..., f(n-1) on the worker threads.
+    Calls made from inside a worker run serially on that worker.
+    */
+    template <class F>
+    void parallel_for(long n, F f) {
+        int threads = get_num_threads();
+        if (threads > n) {
+            threads = n;
+        }
+        if (threads <= 1 || in_worker) {
+            for (long i = 0; i < n; i++) {
+                f(i);
+            }
+            return;
+        }
+
+        std::atomic<long> next(0);
+        std::exception_ptr err = nullptr;
+        std::atomic_flag failed = ATOMIC_FLAG_INIT;
+        auto work = [&]() {
+            in_worker = true;
+            try {
+                for (long i = next++; i < n; i = next++) {
+                    f(i);
+                }
+            }
+            catch (...) {
+                if (!failed.test_and_set()) {
+                    err = std::current_exception();
+                }
+                next = n;
+            }
+            in_worker = false;
+        };
+
+        std::vector<std::thread> pool;
+        for (int t = 1; t < threads; t++) {
+            pool.push_back(std::thread(work));
+        }
+        work();
+        for (auto &th : pool) {
+            th.join();
+        }
+        if (err) {
+            std::rethrow_exception(err);
+        }
+    }
+}
@@ -0,0 +1,226 @@
+#pragma once
+
+#include <stdio.h>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include "gmp.h"
+#include "paillier.h"
+#include "soci.h"
+
+using namespace phe;
+using namespace std;
+
+namespace soci {
+
+    void swap_tuple(smul_tuple &a, smul_tuple &b) {
+        mpz_swap(a.r1, b.r1);
+        mpz_swap(a.r2, b.r2);
+        mpz_swap(a.er1, b.er1);
+        mpz_swap(a.er2, b.er2);
+        mpz_swap(a.er1r2, b.er1r2);
+    }
+
+    void swap_tuple(scmp_tuple &a, scmp_tuple &b) {
+        mpz_swap(a.r0, b.r0);
+        mpz_swap(a.r1, b.r1);
+        mpz_swap(a.er2, b.er2);
+    }
+
+    void swap_tuple(ssba_tuple &a, ssba_tuple &b) {
+        swap_tuple((scmp_tuple &)a, (scmp_tuple &)b);
+        mpz_swap(a.r3, b.r3);
+        mpz_swap(a.er3, b.er3);
+    }
+
+    /*Depletion metrics of one kind of tuple*/
+    class pool_stats {
+
+    public:
+        long taken = 0;         // online protocol calls served from the pool
+        long missed = 0;        // calls that found the pool empty and generated online
+        long produced = 0;      // tuples generated offline
+        long refills = 0;       // times the level dropped below the low-water mark
+        size_t level = 0;       // tuples currently stored
+        size_t min_level = 0;   // lowest level seen since the last fill
+    };
+
+    /*
+    Offline precomputation of the input-independent randomness of smul, scmp
+    and fssba. Attach it to a seccomp with sc.pool = &pool. ssba and sdiv draw
+    their scmp and smul tuples from the same pool. fill() runs the offline
+    phase synchronously, start() keeps every store above low_water from a
+    background thread. The key must be the one used by cp.
+    */
+    class randpool : public tuple_store {
+
+    public:
+        Paillier pai;
+        size_t capacity, low_water;
+
+        randpool(Paillier pai, size_t capacity = 1024, size_t low_water = 256)
+            : pai(pai), capacity(capacity), low_water(low_water) {
+        }
+
+        randpool(const randpool &) = delete;
+        randpool& operator=(const randpool &) = delete;
+
+        ~randpool() {
+            stop();
+            clear(smuls);
+            clear(scmps);
+            clear(ssbas);
+        }
+
+        void fill();
+        void start();
+        void stop();
+        bool take(smul_tuple &t) override { return take_from(smuls, t); }
+        bool take(scmp_tuple &t) override { return take_from(scmps, t); }
+        bool take(ssba_tuple &t) override { return take_from(ssbas, t); }
+        pool_stats stats_smul() { return stats_of(smuls); }
+        pool_stats stats_scmp() { return stats_of(scmps); }
+        pool_stats stats_ssba() { return stats_of(ssbas); }
+        void report(FILE *fp);
+
+    private:
+        template <class T>
+        struct store {
+            deque<T *> q;
+            pool_stats st;
+        };
+
+        store<smul_tuple> smuls;
+        store<scmp_tuple> scmps;
+        store<ssba_tuple> ssbas;
+        mutex mtx;
+        condition_variable low;
+        thread refiller;
+        bool running = false, stopping = false;
+
+        template <class T> bool take_from(store<T> &s, T &t);
+        template <class T> void top_up(store<T> &s);
+        template <class T> pool_stats stats_of(store<T> &s);
+        template <class T> void clear(store<T> &s);
+        bool below_low_water();
+    };
+
+    template <class T>
+    bool randpool::take_from(store<T> &s, T &t) {
+        lock_guard<mutex> lock(mtx);
+        if (s.q.empty()) {
+            s.st.missed++;
+            low.notify_one();
+            return false;
+        }
+        T *p = s.q.front();
+        s.q.pop_front();
+        swap_tuple(t, *p);
+        delete p;
+        s.st.taken++;
+        if (s.q.size() < s.st.min_level) {
+            s.st.min_level = s.q.size();
+        }
+        if (s.q.size() + 1 == low_water) {     // first take below the mark, the refiller waits for < low_water
+            s.st.refills++;
+            low.notify_one();
+        }
+        return true;
+    }
+
+    /*Generate tuples until the store holds capacity of them*/
+    template <class T>
+    void randpool::top_up(store<T> &s) {
+        while (true) {
+            {
+                lock_guard<mutex> lock(mtx);
+                if (s.q.size() >= capacity || stopping) {
+                    return;
+                }
+            }
+            T *p = new T();
+            gen_tuple(*p, pai);
+            lock_guard<mutex> lock(mtx);
+            s.q.push_back(p);
+            s.st.produced++;
+        }
+    }
+
+    template <class T>
+    pool_stats randpool::stats_of(store<T> &s) {
+        lock_guard<mutex> lock(mtx);
+        pool_stats st = s.st;
+        st.level = s.q.size();
+        return st;
+    }
+
+    template <class T>
+    void randpool::clear(store<T> &s) {
+        for (T *p : s.q) {
+            delete p;
+        }
+        s.q.clear();
+    }
+
+    bool randpool::below_low_water() {
+        return smuls.q.size() < low_water || scmps.q.size() < low_water || ssbas.q.size() < low_water;
+    }
+
+    /*Offline phase, fills every store to capacity*/
+    void randpool::fill() {
+        parallel_for(3, [&](int k) {
+            k == 0 ? top_up(smuls) : k == 1 ? top_up(scmps) : top_up(ssbas);
+        });
+        lock_guard<mutex> lock(mtx);
+        smuls.st.min_level = smuls.q.size();
+        scmps.st.min_level = scmps.q.size();
+        ssbas.st.min_level = ssbas.q.size();
+    }
+
+    /*Refill in the background whenever a store drops below low_water*/
+    void randpool::start() {
+        lock_guard<mutex> lock(mtx);
+        if (running) {
+            return;
+        }
+        running = true;
+        refiller = thread([this] {
+            while (true) {
+                {
+                    unique_lock<mutex> lock(mtx);
+                    low.wait(lock, [&] { return !running || below_low_water(); });
+                    if (!running) {
+                        return;
+                    }
+                }
+                top_up(smuls);
+                top_up(scmps);
+                top_up(ssbas);
+            }
+        });
+    }
+
+    void randpool::stop() {
+        {
+            lock_guard<mutex> lock(mtx);
+            running = false;
+            stopping = true;
+            low.notify_all();
+        }
+        if (refiller.joinable()) {
+            refiller.join();
+        }
+        lock_guard<mutex> lock(mtx);
+        stopping = false;
+    }
+
+    void randpool::report(FILE *fp) {
+        const char *names[3] = { "smul", "scmp", "ssba" };
+        pool_stats st[3] = { stats_smul(), stats_scmp(), stats_ssba() };
+        for (int k = 0; k < 3; k++) {
+            fprintf(fp, "%s tuples: level %zu (min %zu), taken %ld, missed %ld, produced %ld, refills %ld\n",
+                names[k], st[k].level, st[k].min_level, st[k].taken, st[k].missed, st[k].produced, st[k].refills);
+        }
+    }
+}
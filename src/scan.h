@@ -0,0 +1,164 @@
+#pragma once
+
+#include <future>
+#include "gmp.h"
+#include "paillier.h"
+#include "soci.h"
+#include "tune.h"
+
+using namespace phe;
+using namespace std;
+
+namespace soci {
+
+    /*Comparison of the scanned column x against the constant t*/
+    enum predicate { GT, GE, LT, LE };
+
+    /*
+    Streaming predicate scan, SELECT SUM(v), COUNT(*) WHERE x op t.
+    Rows are fed chunk by chunk. For each chunk the comparisons run as one
+    batched scmp round and the masking as one batched smul round, while the
+    homomorphic fold of the previous chunk runs in the background.
+    Memory is bounded by two chunks of scratch ciphertexts.
+    */
+    class pscan {
+
+    public:
+        PaillierThd cp, csp;
+        seccomp sc;
+        int chunk;
+
+        pscan(PaillierThd cp, PaillierThd csp, int chunk = 0) : cp(cp), csp(csp), chunk(chunk > 0 ? chunk : tuned(cp.pai.pubkey).chunk) {
+            mpz_inits(this->esum, this->ecount, this->et, NULL);
+            for (int b = 0; b < 2; b++) {
+                this->mask[b] = new mpz_t[this->chunk];
+                this->prod[b] = new mpz_t[this->chunk];
+                for (int i = 0; i < this->chunk; i++) {
+                    mpz_inits(this->mask[b][i], this->prod[b][i], NULL);
+                }
+            }
+        }
+
+        pscan(const pscan &) = delete;
+        pscan& operator=(const pscan &) = delete;
+
+        ~pscan() {
+            if (pending.valid()) {
+                pending.wait();
+            }
+            for (int b = 0; b < 2; b++) {
+                for (int i = 0; i < chunk; i++) {
+                    mpz_clears(mask[b][i], prod[b][i], NULL);
+                }
+                delete[] mask[b];
+                delete[] prod[b];
+            }
+            mpz_clears(esum, ecount, et, NULL);
+        }
+
+        void begin(const mpz_t et, predicate op);
+        void feed(mpz_t *x, mpz_t *v, long n);
+        void feed(const CipherVector &x, const CipherVector *v);
+        void finish(mpz_t esum, mpz_t ecount);
+        void run(mpz_t esum, mpz_t ecount, mpz_t *x, mpz_t *v, long n, const mpz_t et, predicate op);
+
+    private:
+        mpz_t esum, ecount, et;
+        mpz_t *mask[2], *prod[2];
+        int cur = 0;
+        predicate op = GT;
+        future<void> pending;
+
+        void fold(int b, int n, bool sum);
+    };
+
+    /*Start a new scan of x op t*/
+    void pscan::begin(const mpz_t et, predicate op) {
+        if (pending.valid()) {
+            pending.get();
+        }
+        mpz_set(this->et, et);
+        mpz_set(this->esum, cp.ezero);
+        mpz_set(this->ecount, cp.ezero);
+        this->op = op;
+    }
+
+    /*
+    Scan the next n rows. v may be NULL, in which case only COUNT is computed
+    and the smul round is skipped.
+    */
+    void pscan::feed(mpz_t *x, mpz_t *v, long n) {
+        for (long off = 0; off < n; off += chunk) {
+            int m = n - off < chunk ? n - off : chunk;
+            mpz_t *mk = mask[cur], *pd = prod[cur];
+
+            // Round 1: mk[i] = [x_i op t]
+            if (op == GT || op == LE) {
+                sc.scmp(mk, et, x + off, m, cp, csp);      // [t < x_i]
+            }
+            else {
+                sc.scmp(mk, x + off, et, m, cp, csp);      // [x_i < t]
+            }
+            if (op == GE || op == LE) {
+                parallel_for(m, [&](int i) {
+                    cp.pai.scl_mul(mk[i], mk[i], sc.neg_one);
+                    cp.pai.add(mk[i], cp.eone, mk[i]);
+                });
+            }
+
+            // Round 2: pd[i] = [mask_i * v_i]
+            if (v != NULL) {
+                sc.smul(pd, mk, v + off, m, cp, csp);
+            }
+
+            if (pending.valid()) {
+                pending.get();
+            }
+            pending = async(launch::async, &pscan::fold, this, cur, m, v != NULL);
+            cur = 1 - cur;
+        }
+    }
+
+    /*Scan the rows of a column, reading it in place through views chunk by chunk*/
+    void pscan::feed(const CipherVector &x, const CipherVector *v) {
+        mpz_t *xv = new mpz_t[chunk], *vv = new mpz_t[chunk];
+        for (size_t off = 0; off < x.size(); off += chunk) {
+            int m = x.size() - off < (size_t)chunk ? x.size() - off : chunk;
+            for (int i = 0; i < m; i++) {
+                x.view(xv[i], off + i);
+                if (v != NULL) {
+                    v->view(vv[i], off + i);
+                }
+            }
+            feed(xv, v != NULL ? vv : NULL, m);
+        }
+        delete[] xv;
+        delete[] vv;
+    }
+
+    /*Add chunk b to the accumulators, sum tells whether prod[b] holds this chunk's products*/
+    void pscan::fold(int b, int n, bool sum) {
+        for (int i = 0; i < n; i++) {
+            cp.pai.add(ecount, ecount, mask[b][i]);
+            if (sum) {
+                cp.pai.add(esum, esum, prod[b][i]);
+            }
+        }
+    }
+
+    /*Wait for the last chunk and output [SUM(v)] and [COUNT(*)]*/
+    void pscan::finish(mpz_t esum, mpz_t ecount) {
+        if (pending.valid()) {
+            pending.get();
+        }
+        mpz_set(esum, this->esum);
+        mpz_set(ecount, this->ecount);
+    }
+
+    /*Scan n rows held in memory*/
+    void pscan::run(mpz_t esum, mpz_t ecount, mpz_t *x, mpz_t *v, long n, const mpz_t et, predicate op) {
+        begin(et, op);
+        feed(x, v, n);
+        finish(esum, ecount);
+    }
+}
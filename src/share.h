@@ -0,0 +1,280 @@
+#pragma once
+
+#include <deque>
+#include "gmp.h"
+#include "paillier.h"
+#include "soci.h"
+
+using namespace phe;
+using namespace std;
+
+namespace soci {
+
+    /*Additive sharing x = s1 + s2 mod N^s, s1 is held by CP and s2 by CSP*/
+    class ashare {
+
+    public:
+        mpz_t s1, s2;
+
+        ashare() {
+            mpz_inits(this->s1, this->s2, NULL);
+        }
+
+        ashare(const ashare &) = delete;
+        ashare& operator=(const ashare &) = delete;
+
+        ~ashare() {
+            mpz_clears(this->s1, this->s2, NULL);
+        }
+    };
+
+    /*Beaver triple c = a*b mod N^s, shared between CP and CSP*/
+    class beaver_triple {
+
+    public:
+        ashare a, b, c;
+    };
+
+    /*
+    Hybrid mode: ciphertexts are converted into additive shares mod N^s for
+    multiplication-heavy phases, multiplied with Beaver triples using plain
+    modular arithmetic, and converted back. The triples are generated
+    offline with Paillier, so the online phase of mul() has no modexp.
+    Both parties are run in this process; the comments say who computes what.
+    The triple store is not thread safe, the batched calls use it from one thread.
+    */
+    class hybrid {
+
+    public:
+        PaillierThd cp, csp;
+
+        hybrid(PaillierThd cp, PaillierThd csp) : cp(cp), csp(csp) {
+        }
+
+        hybrid(const hybrid &) = delete;
+        hybrid& operator=(const hybrid &) = delete;
+
+        ~hybrid() {
+            for (beaver_triple *t : store) {
+                delete t;
+            }
+        }
+
+        void gen_triples(int n);
+        size_t triples() { return store.size(); }
+        void to_share(ashare &x, const mpz_t ex);
+        void to_share(ashare *x, mpz_t *ex, int n);
+        void from_share(mpz_t ex, ashare &x);
+        void from_share(mpz_t *ex, ashare *x, int n);
+        void add(ashare &z, ashare &x, ashare &y);
+        void sub(ashare &z, ashare &x, ashare &y);
+        void scl_mul(ashare &z, ashare &x, const mpz_t k);
+        void add_const(ashare &z, ashare &x, const mpz_t k);
+        void mul(ashare &z, ashare &x, ashare &y);
+        void mul(ashare *z, ashare *x, ashare *y, int n);
+
+    private:
+        deque<beaver_triple *> store;
+
+        void random_mod(mpz_t r);
+        void gen_triple(beaver_triple &t);
+        beaver_triple *take();
+        void mul(ashare &z, ashare &x, ashare &y, beaver_triple &t);
+    };
+
+    /*r uniform in [0, N^s)*/
+    void hybrid::random_mod(mpz_t r) {
+        gmp_rand_mutex.lock();
+        mpz_urandomm(r, gmp_rand, cp.pai.pubkey.ns);
+        gmp_rand_mutex.unlock();
+    }
+
+    /*
+    CP picks a1, b1 and CSP picks a2, b2. CSP sends [a2], [b2], CP returns
+    [a1*b2 + a2*b1 - rho] for a uniform rho, which both decrypt jointly
+    for CSP. Then c1 = a1*b1 + rho and c2 = a2*b2 + a1*b2 + a2*b1 - rho.
+    */
+    void hybrid::gen_triple(beaver_triple &t) {
+        mpz_t ea2, eb2, rho, E, E1, E2, m;
+        mpz_inits(ea2, eb2, rho, E, E1, E2, m, NULL);
+        mpz_t &ns = cp.pai.pubkey.ns;
+
+        // CSP
+        random_mod(t.a.s2);
+        random_mod(t.b.s2);
+        csp.pai.encrypt(ea2, t.a.s2);
+        csp.pai.encrypt(eb2, t.b.s2);
+
+        // CP
+        random_mod(t.a.s1);
+        random_mod(t.b.s1);
+        random_mod(rho);
+        cp.pai.scl_mul(E, eb2, t.a.s1);
+        cp.pai.scl_mul(ea2, ea2, t.b.s1);
+        cp.pai.add(E, E, ea2);
+        mpz_sub(m, ns, rho);
+        mpz_mod(m, m, ns);
+        cp.pai.encrypt(E1, m);
+        cp.pai.add(E, E, E1);               // [a1*b2 + a2*b1 - rho]
+        cp.pdec(E1, E);
+        mpz_mul(t.c.s1, t.a.s1, t.b.s1);
+        mpz_add(t.c.s1, t.c.s1, rho);
+        mpz_mod(t.c.s1, t.c.s1, ns);
+
+        // CSP
+        csp.pdec(E2, E);
+        csp.fdec(m, E1, E2);
+        mpz_mul(t.c.s2, t.a.s2, t.b.s2);
+        mpz_add(t.c.s2, t.c.s2, m);
+        mpz_mod(t.c.s2, t.c.s2, ns);
+
+        mpz_clears(ea2, eb2, rho, E, E1, E2, m, NULL);
+    }
+
+    /*Offline phase, adds n triples to the store*/
+    void hybrid::gen_triples(int n) {
+        vector<beaver_triple *> ts(n);
+        parallel_for(n, [&](int i) {
+            ts[i] = new beaver_triple();
+            gen_triple(*ts[i]);
+        });
+        store.insert(store.end(), ts.begin(), ts.end());
+    }
+
+    /*Next stored triple, or a fresh one if the store is empty*/
+    beaver_triple *hybrid::take() {
+        if (store.empty()) {
+            beaver_triple *t = new beaver_triple();
+            gen_triple(*t);
+            return t;
+        }
+        beaver_triple *t = store.front();
+        store.pop_front();
+        return t;
+    }
+
+    /*
+    [x] -> shares of x in one round: CP sends [x + r] with its partial
+    decryption and keeps s1 = -r, CSP decrypts s2 = x + r.
+    */
+    void hybrid::to_share(ashare &x, const mpz_t ex) {
+        mpz_t r, er, C, C1, C2;
+        mpz_inits(r, er, C, C1, C2, NULL);
+        // CP
+        random_mod(r);
+        cp.pai.encrypt(er, r);
+        cp.pai.add(C, ex, er);
+        cp.pdec(C1, C);
+        mpz_sub(x.s1, cp.pai.pubkey.ns, r);
+        mpz_mod(x.s1, x.s1, cp.pai.pubkey.ns);
+        // CSP
+        csp.pdec(C2, C);
+        csp.fdec(x.s2, C1, C2);
+        mpz_clears(r, er, C, C1, C2, NULL);
+    }
+
+    void hybrid::to_share(ashare *x, mpz_t *ex, int n) {
+        parallel_for(n, [&](int i) {
+            to_share(x[i], ex[i]);
+        });
+    }
+
+    /*Shares -> [x]: CSP sends [s2], CP adds s1*/
+    void hybrid::from_share(mpz_t ex, ashare &x) {
+        mpz_t e1;
+        mpz_init(e1);
+        csp.pai.encrypt(ex, x.s2);
+        cp.pai.encrypt(e1, x.s1);
+        cp.pai.add(ex, ex, e1);
+        mpz_clear(e1);
+    }
+
+    void hybrid::from_share(mpz_t *ex, ashare *x, int n) {
+        parallel_for(n, [&](int i) {
+            from_share(ex[i], x[i]);
+        });
+    }
+
+    void hybrid::add(ashare &z, ashare &x, ashare &y) {
+        mpz_add(z.s1, x.s1, y.s1);
+        mpz_mod(z.s1, z.s1, cp.pai.pubkey.ns);
+        mpz_add(z.s2, x.s2, y.s2);
+        mpz_mod(z.s2, z.s2, cp.pai.pubkey.ns);
+    }
+
+    void hybrid::sub(ashare &z, ashare &x, ashare &y) {
+        mpz_sub(z.s1, x.s1, y.s1);
+        mpz_mod(z.s1, z.s1, cp.pai.pubkey.ns);
+        mpz_sub(z.s2, x.s2, y.s2);
+        mpz_mod(z.s2, z.s2, cp.pai.pubkey.ns);
+    }
+
+    /*z = k*x for a public k*/
+    void hybrid::scl_mul(ashare &z, ashare &x, const mpz_t k) {
+        mpz_mul(z.s1, x.s1, k);
+        mpz_mod(z.s1, z.s1, cp.pai.pubkey.ns);
+        mpz_mul(z.s2, x.s2, k);
+        mpz_mod(z.s2, z.s2, cp.pai.pubkey.ns);
+    }
+
+    /*z = x + k for a public k, added by CP*/
+    void hybrid::add_const(ashare &z, ashare &x, const mpz_t k) {
+        mpz_add(z.s1, x.s1, k);
+        mpz_mod(z.s1, z.s1, cp.pai.pubkey.ns);
+        mpz_set(z.s2, x.s2);
+    }
+
+    /*
+    z = x*y with the triple t: both parties open d = x - a and e = y - b,
+    then z = c + d*b + e*a + d*e, where CP adds the public d*e.
+    */
+    void hybrid::mul(ashare &z, ashare &x, ashare &y, beaver_triple &t) {
+        mpz_t &ns = cp.pai.pubkey.ns;
+        mpz_t d, e, u;
+        mpz_inits(d, e, u, NULL);
+        mpz_sub(d, x.s1, t.a.s1);
+        mpz_add(d, d, x.s2);
+        mpz_sub(d, d, t.a.s2);
+        mpz_mod(d, d, ns);
+        mpz_sub(e, y.s1, t.b.s1);
+        mpz_add(e, e, y.s2);
+        mpz_sub(e, e, t.b.s2);
+        mpz_mod(e, e, ns);
+
+        // CP: z1 = c1 + d*b1 + e*a1 + d*e
+        mpz_mul(u, d, e);
+        mpz_addmul(u, d, t.b.s1);
+        mpz_addmul(u, e, t.a.s1);
+        mpz_add(u, u, t.c.s1);
+        mpz_mod(z.s1, u, ns);
+        // CSP: z2 = c2 + d*b2 + e*a2
+        mpz_set(u, t.c.s2);
+        mpz_addmul(u, d, t.b.s2);
+        mpz_addmul(u, e, t.a.s2);
+        mpz_mod(z.s2, u, ns);
+        mpz_clears(d, e, u, NULL);
+    }
+
+    /*z = x*y, consumes one triple*/
+    void hybrid::mul(ashare &z, ashare &x, ashare &y) {
+        beaver_triple *t = take();
+        mul(z, x, y, *t);
+        delete t;
+    }
+
+    /*n multiplications in one round, consumes n triples*/
+    void hybrid::mul(ashare *z, ashare *x, ashare *y, int n) {
+        vector<beaver_triple *> ts(n);
+        for (int i = 0; i < n; i++) {
+            ts[i] = store.empty() ? NULL : take();
+        }
+        parallel_for(n, [&](int i) {
+            if (ts[i] == NULL) {
+                ts[i] = new beaver_triple();
+                gen_triple(*ts[i]);
+            }
+            mul(z[i], x[i], y[i], *ts[i]);
+            delete ts[i];
+        });
+    }
+}
@@ -1,17 +1,127 @@
 #pragma once
 
+#include <stdio.h>
+#include <atomic>
 #include "gmp.h"
 #include "paillier.h"
+#include "parallel.h"
+#include "ciphervec.h"
 
 using namespace phe;
 using namespace std;
 
 namespace soci {
 
+    /*
+    Input-independent randomness of the protocols, i.e., the plaintext masks
+    together with their encryptions. These can be generated offline, see precomp.h.
+    */
+
+    /*smul: r1, r2, [r1], [r2], [-r1*r2]*/
+    class smul_tuple {
+
+    public:
+        mpz_t r1, r2, er1, er2, er1r2;
+
+        smul_tuple() {
+            mpz_inits(this->r1, this->r2, this->er1, this->er2, this->er1r2, NULL);
+        }
+
+        smul_tuple(const smul_tuple &) = delete;
+        smul_tuple& operator=(const smul_tuple &) = delete;
+
+        ~smul_tuple() {
+            mpz_clears(this->r1, this->r2, this->er1, this->er2, this->er1r2, NULL);
+        }
+    };
+
+    /*scmp: r0, r1, [r1+N/2-r0] if r0 is even, [N/2-r0] otherwise*/
+    class scmp_tuple {
+
+    public:
+        mpz_t r0, r1, er2;
+
+        scmp_tuple() {
+            mpz_inits(this->r0, this->r1, this->er2, NULL);
+        }
+
+        scmp_tuple(const scmp_tuple &) = delete;
+        scmp_tuple& operator=(const scmp_tuple &) = delete;
+
+        ~scmp_tuple() {
+            mpz_clears(this->r0, this->r1, this->er2, NULL);
+        }
+    };
+
+    /*fssba: the scmp tuple against [0] and r3, [r3]*/
+    class ssba_tuple : public scmp_tuple {
+
+    public:
+        mpz_t r3, er3;
+
+        ssba_tuple() : scmp_tuple() {
+            mpz_inits(this->r3, this->er3, NULL);
+        }
+
+        ~ssba_tuple() {
+            mpz_clears(this->r3, this->er3, NULL);
+        }
+    };
+
+    /*Store of precomputed tuples, take() returns false when it is empty*/
+    class tuple_store {
+
+    public:
+        virtual bool take(smul_tuple &t) = 0;
+        virtual bool take(scmp_tuple &t) = 0;
+        virtual bool take(ssba_tuple &t) = 0;
+        virtual ~tuple_store() {
+        }
+    };
+
+    /*Protocols whose CP<->CSP traffic is recorded*/
+    enum comm_proto { C_SMUL, C_SCMP, C_FSSBA, C_SDIV_PUB, C_SMUL_PACKED, C_SCMP_PACKED, C_PROTOS };
+
+    /*
+    CP<->CSP traffic per protocol: instances, messages and bytes in each
+    direction. A round of a batched call is one message each way however
+    many instances it carries. Ciphertexts and partial decryptions are
+    counted at their fixed wire width, cipher_bytes(pk).
+    */
+    class comm_stats {
+
+    public:
+        atomic<long> ops[C_PROTOS], msgs[C_PROTOS], to_csp[C_PROTOS], to_cp[C_PROTOS];
+
+        comm_stats() {
+            reset();
+        }
+
+        void reset() {
+            for (int p = 0; p < C_PROTOS; p++) {
+                ops[p] = msgs[p] = to_csp[p] = to_cp[p] = 0;
+            }
+        }
+
+        void report(FILE *fp) {
+            const char *name[C_PROTOS] = { "smul", "scmp", "fssba", "sdiv_pub", "smul_packed", "scmp_packed" };
+            fprintf(fp, "%-12s %10s %10s %14s %14s %12s\n", "protocol", "ops", "messages", "CP->CSP", "CSP->CP", "bytes/op");
+            for (int p = 0; p < C_PROTOS; p++) {
+                if (ops[p] == 0) {
+                    continue;
+                }
+                fprintf(fp, "%-12s %10ld %10ld %14ld %14ld %12.1f\n", name[p], ops[p].load(), msgs[p].load(),
+                    to_csp[p].load(), to_cp[p].load(), (double)(to_csp[p] + to_cp[p]) / ops[p]);
+            }
+        }
+    };
+
     class seccomp {
 
     public:
         mpz_t neg_one, neg_two;
+        tuple_store *pool = NULL;   // if set, protocols take their randomness from it
+        comm_stats *comm = NULL;    // if set, CP<->CSP traffic is recorded in it
 
         seccomp() {
             mpz_inits(this->neg_one, this->neg_two, NULL);
@@ -23,16 +133,65 @@ namespace soci {
             mpz_clears(this->neg_one, this->neg_two, NULL);
         }
 
-        void smul(mpz_t res, mpz_t ex, mpz_t ey, PaillierThd cp, PaillierThd csp);
-        void scmp(mpz_t res, mpz_t ex, mpz_t ey, PaillierThd cp, PaillierThd csp);
-        void ssba(mpz_t s_x, mpz_t u_x, mpz_t c, PaillierThd cp, PaillierThd csp);
-        void sdiv(mpz_t eq, mpz_t er, mpz_t ex, mpz_t ey, int ell, PaillierThd cp, PaillierThd csp, Paillier pai);
+        void smul(mpz_t res, const mpz_t ex, const mpz_t ey, PaillierThd cp, PaillierThd csp);
+        void smul(mpz_t *res, mpz_t *ex, mpz_t *ey, int n, PaillierThd cp, PaillierThd csp);
+        void scmp(mpz_t res, const mpz_t ex, const mpz_t ey, PaillierThd cp, PaillierThd csp);
+        void scmp(mpz_t *res, mpz_t *ex, mpz_t *ey, int n, PaillierThd cp, PaillierThd csp);
+        void scmp(mpz_t *res, mpz_t *ex, const mpz_t ey, int n, PaillierThd cp, PaillierThd csp);
+        void scmp(mpz_t *res, const mpz_t ex, mpz_t *ey, int n, PaillierThd cp, PaillierThd csp);
+        void ssba(mpz_t s_x, mpz_t u_x, const mpz_t c, PaillierThd cp, PaillierThd csp);
+        void fssba(mpz_t s_x, mpz_t u_x, const mpz_t c, PaillierThd cp, PaillierThd csp);
+        void fssba(mpz_t *s_x, mpz_t *u_x, mpz_t *c, int n, PaillierThd cp, PaillierThd csp);
+        void sdiv(mpz_t eq, mpz_t er, const mpz_t ex, const mpz_t ey, int ell, PaillierThd cp, PaillierThd csp, Paillier pai);
+        void sdiv_pub(mpz_t eq, const mpz_t ex, const mpz_t d, int ell, PaillierThd cp, PaillierThd csp, bool exact = true);
+        void sdiv_pub(mpz_t *eq, mpz_t *ex, int n, const mpz_t d, int ell, PaillierThd cp, PaillierThd csp, bool exact = true);
+        void strunc(mpz_t eq, const mpz_t ex, int k, int ell, PaillierThd cp, PaillierThd csp, bool exact = true);
+        void strunc(mpz_t *eq, mpz_t *ex, int n, int k, int ell, PaillierThd cp, PaillierThd csp, bool exact = true);
+        void sprod(mpz_t res, mpz_t *ex, int k, PaillierThd cp, PaillierThd csp);
+        void spow(mpz_t res, const mpz_t ex, unsigned long d, PaillierThd cp, PaillierThd csp);
+        void spowers(mpz_t *ep, const mpz_t ex, int d, PaillierThd cp, PaillierThd csp);
+        void spoly(mpz_t res, const mpz_t ex, mpz_t *a, int deg, PaillierThd cp, PaillierThd csp);
+        void smul(CipherVector &res, const CipherVector &ex, const CipherVector &ey, PaillierThd cp, PaillierThd csp);
+        void scmp(CipherVector &res, const CipherVector &ex, const CipherVector &ey, PaillierThd cp, PaillierThd csp);
+        void scmp(CipherVector &res, const CipherVector &ex, const mpz_t ey, PaillierThd cp, PaillierThd csp);
+        void scmp(CipherVector &res, const mpz_t ex, const CipherVector &ey, PaillierThd cp, PaillierThd csp);
+        void fssba(CipherVector &s_x, CipherVector &u_x, const CipherVector &c, PaillierThd cp, PaillierThd csp);
+        void sdiv_pub(CipherVector &eq, const CipherVector &ex, const mpz_t d, int ell, PaillierThd cp, PaillierThd csp, bool exact = true);
+        void smul_packed(mpz_t *res, mpz_t *ex, mpz_t *ey, int n, int ell, PaillierThd cp, PaillierThd csp);
+        void scmp_packed(mpz_t *res, mpz_t *ex, mpz_t *ey, int n, int ell, PaillierThd cp, PaillierThd csp);
+
+    private:
+        void smul_once(mpz_t res, const mpz_t ex, const mpz_t ey, PaillierThd &cp, PaillierThd &csp);
+        void scmp_once(mpz_t res, const mpz_t ex, const mpz_t ey, PaillierThd &cp, PaillierThd &csp);
+        void fssba_once(mpz_t s_x, mpz_t u_x, const mpz_t c, PaillierThd &cp, PaillierThd &csp);
+        void sdiv_pub_once(mpz_t eq, const mpz_t ex, const mpz_t d, int ell, PaillierThd &cp, PaillierThd &csp, bool exact);
+        void traffic(comm_proto p, PaillierThd &cp, long ops, long to_csp, long to_cp);
+        void round(comm_proto p);
     };
-    const int sigma = 128;
+
+    /*Record ops instances sending to_csp and to_cp values of cipher_bytes each*/
+    void seccomp::traffic(comm_proto p, PaillierThd &cp, long ops, long to_csp, long to_cp) {
+        if (comm == NULL) {
+            return;
+        }
+        long b = cipher_bytes(cp.pai.pubkey);
+        comm->ops[p] += ops;
+        comm->to_csp[p] += to_csp * b;
+        comm->to_cp[p] += to_cp * b;
+    }
+
+    /*Record one round, a message each way*/
+    void seccomp::round(comm_proto p) {
+        if (comm != NULL) {
+            comm->msgs[p] += 2;
+        }
+    }
 
     void get_secRandNum(mpz_t r, int sigma) {
     
+        gmp_rand_mutex.lock();
         mpz_rrandomb(r, gmp_rand, sigma);
+        gmp_rand_mutex.unlock();
     }
 
     void get_secRandNum(mpz_t r) {
@@ -40,18 +199,57 @@ namespace soci {
         get_secRandNum(r, sigma);
     }
 
+    void gen_tuple(smul_tuple &t, Paillier &pai) {
+        mpz_t r1r2;
+        mpz_init(r1r2);
+        get_secRandNum(t.r1, sigma);
+        get_secRandNum(t.r2, sigma);
+        pai.encrypt(t.er1, t.r1);
+        pai.encrypt(t.er2, t.r2);
+        mpz_mul(r1r2, t.r1, t.r2);
+        mpz_neg(r1r2, r1r2);
+        mpz_mod(r1r2, r1r2, pai.pubkey.ns);    //-r1*r2
+        pai.encrypt(t.er1r2, r1r2);
+        mpz_clear(r1r2);
+    }
+
+    void gen_tuple(scmp_tuple &t, Paillier &pai) {
+        mpz_t r2;
+        mpz_init(r2);
+        get_secRandNum(t.r0, sigma);
+        get_secRandNum(t.r1, sigma + sigma);
+        mpz_sub(r2, pai.pubkey.half_n, t.r0);
+        if (mpz_odd_p(t.r0) == 0) {
+            mpz_add(r2, t.r1, r2);
+        }
+        pai.encrypt(t.er2, r2);
+        mpz_clear(r2);
+    }
+
+    void gen_tuple(ssba_tuple &t, Paillier &pai) {
+        gen_tuple((scmp_tuple &)t, pai);
+        get_secRandNum(t.r3, sigma);
+        pai.encrypt(t.er3, t.r3);
+    }
+
     /*Secure Multiplication Protocol*/
-    void seccomp::smul(mpz_t res, mpz_t ex, mpz_t ey, PaillierThd cp, PaillierThd csp) {
+    void seccomp::smul(mpz_t res, const mpz_t ex, const mpz_t ey, PaillierThd cp, PaillierThd csp) {
+        smul_once(res, ex, ey, cp, csp);
+        round(C_SMUL);
+    }
+
+    /*CP sends X, Y and their partial decryptions, CSP returns [x*y]*/
+    void seccomp::smul_once(mpz_t res, const mpz_t ex, const mpz_t ey, PaillierThd &cp, PaillierThd &csp) {
         // step 1
-        mpz_t r1, r2, er1, er2, X, Y, X1, Y1, r1r2, er1r2;
-        mpz_inits(r1, r2, er1, er2, X, Y, X1, Y1, r1r2, er1r2, NULL);
-        get_secRandNum(r1, sigma);
-        get_secRandNum(r2, sigma);
-        cp.pai.encrypt(er1, r1);
-        cp.pai.encrypt(er2, r2);
-
-        cp.pai.add(X, ex, er1);
-        cp.pai.add(Y, ey, er2);
+        smul_tuple tp;
+        if (pool == NULL || !pool->take(tp)) {
+            gen_tuple(tp, cp.pai);
+        }
+        mpz_t X, Y, X1, Y1;
+        mpz_inits(X, Y, X1, Y1, NULL);
+
+        cp.pai.add(X, ex, tp.er1);
+        cp.pai.add(Y, ey, tp.er2);
         cp.pdec(X1, X);
         cp.pdec(Y1, Y);
 
@@ -64,55 +262,66 @@ namespace soci {
         csp.fdec(y, Y1, Y2);
 
         mpz_mul(xy, x, y);
-        mpz_mod(xy, xy, csp.pai.pubkey.n);
+        mpz_mod(xy, xy, csp.pai.pubkey.ns);
         csp.pai.encrypt(exy, xy);
 
         // step 3
         mpz_t exr2, eyr1;
         mpz_inits(exr2, eyr1, NULL);
-        mpz_neg(r2, r2);    //-r2
-        cp.pai.scl_mul(exr2, ex, r2);       //-x*r2
-        mpz_mul(r1r2, r1, r2);              //-r1*r2
-        cp.pai.encrypt(er1r2, r1r2);
-        mpz_neg(r1, r1); //not in paper??   //-r1
-        cp.pai.scl_mul(eyr1, ey, r1);       //-y*r1
+        mpz_neg(tp.r2, tp.r2);    //-r2
+        cp.pai.scl_mul(exr2, ex, tp.r2);     //-x*r2
+        mpz_neg(tp.r1, tp.r1); //not in paper??   //-r1
+        cp.pai.scl_mul(eyr1, ey, tp.r1);     //-y*r1
         cp.pai.add(res, exy, exr2);
         cp.pai.add(res, res, eyr1);
-        cp.pai.add(res, res, er1r2);
+        cp.pai.add(res, res, tp.er1r2);      //-r1*r2
 
-        mpz_clears(r1, r2, er1, er2, X, Y, X1, Y1, r1r2, er1r2, NULL);
+        traffic(C_SMUL, cp, 1, 4, 1);
+
+        mpz_clears(X, Y, X1, Y1, NULL);
         mpz_clears(X2, Y2, x, y, xy, exy, NULL);
         mpz_clears(exr2, eyr1, NULL);
     }
 
+    /*
+    Batched Secure Multiplication Protocol.
+    All n instances share one round and run on the worker threads.
+    */
+    void seccomp::smul(mpz_t *res, mpz_t *ex, mpz_t *ey, int n, PaillierThd cp, PaillierThd csp) {
+        parallel_for(n, [&](int i) {
+            smul_once(res[i], ex[i], ey[i], cp, csp);
+        });
+        round(C_SMUL);
+    }
+
     /*Secure Comparison Protocol*/
-    void seccomp::scmp(mpz_t res, mpz_t ex, mpz_t ey, PaillierThd cp, PaillierThd csp) {
+    void seccomp::scmp(mpz_t res, const mpz_t ex, const mpz_t ey, PaillierThd cp, PaillierThd csp) {
+        scmp_once(res, ex, ey, cp, csp);
+        round(C_SCMP);
+    }
+
+    /*CP sends D and its partial decryption, CSP returns the encrypted bit*/
+    void seccomp::scmp_once(mpz_t res, const mpz_t ex, const mpz_t ey, PaillierThd &cp, PaillierThd &csp) {
         //Step-1
-        mpz_t r1, r2, r0, er2, D, D1, exr, eyr;
-        mpz_inits(r1, r2, r0, er2, D, D1, exr, eyr, NULL);
-        get_secRandNum(r0, sigma);
-        get_secRandNum(r1, sigma + sigma);
-        //gmp_printf("r0 = %Zd\n", r0);
-        //gmp_printf("r1 = %Zd\n", r1);
-        mpz_sub(r2, cp.pai.pubkey.half_n, r0);
-        //gmp_printf("cp.pai.pubkey.half_n = %Zd\n", cp.pai.pubkey.half_n);
-        //gmp_printf("r2 = %Zd\n", r2);
-        if (mpz_odd_p(r0) == 0) {       // D = [r_1*(x-y+1)+r2]
-            mpz_add(r2, r1, r2);        // r2 = r1 + r2
-            cp.pai.encrypt(er2, r2);    // er2 = [r1+r2]
-            cp.pai.scl_mul(exr, ex, r1); // ex = [r1 * x]
-            mpz_neg(r1, r1);
-            cp.pai.scl_mul(eyr, ey, r1); // ey = [-r1 * y] 
+        scmp_tuple tp;
+        if (pool == NULL || !pool->take(tp)) {
+            gen_tuple(tp, cp.pai);
+        }
+        mpz_t D, D1, exr, eyr;
+        mpz_inits(D, D1, exr, eyr, NULL);
+        if (mpz_odd_p(tp.r0) == 0) {     // D = [r_1*(x-y+1)+r2]
+            cp.pai.scl_mul(exr, ex, tp.r1); // ex = [r1 * x]
+            mpz_neg(tp.r1, tp.r1);
+            cp.pai.scl_mul(eyr, ey, tp.r1); // ey = [-r1 * y] 
             cp.pai.add(D, exr, eyr);
-            cp.pai.add(D, D, er2);
+            cp.pai.add(D, D, tp.er2);    // er2 = [r1+r2]
         }
         else {                          // D = [r_1*(y-x)+r2]
-            cp.pai.scl_mul(eyr, ey, r1);
-            mpz_neg(r1, r1);
-            cp.pai.scl_mul(exr, ex, r1); 
-            cp.pai.encrypt(er2, r2);
+            cp.pai.scl_mul(eyr, ey, tp.r1);
+            mpz_neg(tp.r1, tp.r1);
+            cp.pai.scl_mul(exr, ex, tp.r1); 
             cp.pai.add(D, eyr, exr);
-            cp.pai.add(D, D, er2);
+            cp.pai.add(D, D, tp.er2);
         }
         cp.pdec(D1, D);
 
@@ -125,20 +334,48 @@ namespace soci {
         mpz_cmp(d, csp.pai.pubkey.half_n) > 0 ? mpz_set(res, csp.ezero) : mpz_set(res, csp.eone);
 
         //Step-3
-        if (mpz_odd_p(r0) == 0) {
+        if (mpz_odd_p(tp.r0) == 0) {
             mpz_set(res, res);
         }
         else {
             cp.pai.scl_mul(res, res, neg_one);
             cp.pai.add(res, cp.eone, res);
         }
+        traffic(C_SCMP, cp, 1, 2, 1);
 
-        mpz_clears(r1, r2, r0, er2, D, D1, exr, eyr, NULL);
+        mpz_clears(D, D1, exr, eyr, NULL);
         mpz_clears(d, D2, NULL);
     }
 
+    /*
+    Batched Secure Comparison Protocol, res[i] = [x_i < y_i].
+    All n instances share one round and run on the worker threads.
+    */
+    void seccomp::scmp(mpz_t *res, mpz_t *ex, mpz_t *ey, int n, PaillierThd cp, PaillierThd csp) {
+        parallel_for(n, [&](int i) {
+            scmp_once(res[i], ex[i], ey[i], cp, csp);
+        });
+        round(C_SCMP);
+    }
+
+    /*res[i] = [x_i < y]*/
+    void seccomp::scmp(mpz_t *res, mpz_t *ex, const mpz_t ey, int n, PaillierThd cp, PaillierThd csp) {
+        parallel_for(n, [&](int i) {
+            scmp_once(res[i], ex[i], ey, cp, csp);
+        });
+        round(C_SCMP);
+    }
+
+    /*res[i] = [x < y_i]*/
+    void seccomp::scmp(mpz_t *res, const mpz_t ex, mpz_t *ey, int n, PaillierThd cp, PaillierThd csp) {
+        parallel_for(n, [&](int i) {
+            scmp_once(res[i], ex, ey[i], cp, csp);
+        });
+        round(C_SCMP);
+    }
+
     /*Secure Sign Bit-Acquisition Protocol*/
-    void seccomp::ssba(mpz_t s_x, mpz_t u_x, mpz_t c, PaillierThd cp, PaillierThd csp) {
+    void seccomp::ssba(mpz_t s_x, mpz_t u_x, const mpz_t c, PaillierThd cp, PaillierThd csp) {
         // Step-1
         scmp(s_x, c, cp.ezero, cp, csp);
 
@@ -154,8 +391,91 @@ namespace soci {
         mpz_clears(sign, NULL);
     }
 
+    /*
+    Fused Secure Sign Bit-Acquisition Protocol.
+    Same output as ssba, but CSP returns the encrypted sign together with
+    the masked magnitude in a single round (two partial decryptions per server
+    instead of three, one for scmp and two for smul).
+    */
+    void seccomp::fssba(mpz_t s_x, mpz_t u_x, const mpz_t c, PaillierThd cp, PaillierThd csp) {
+        fssba_once(s_x, u_x, c, cp, csp);
+        round(C_FSSBA);
+    }
+
+    /*CP sends D, X and their partial decryptions, CSP returns [t] and [t*(x+r3)]*/
+    void seccomp::fssba_once(mpz_t s_x, mpz_t u_x, const mpz_t c, PaillierThd &cp, PaillierThd &csp) {
+        // Step-1
+        ssba_tuple tp;
+        if (pool == NULL || !pool->take(tp)) {
+            gen_tuple(tp, cp.pai);
+        }
+        mpz_t er3, D, X, D1, X1;
+        mpz_inits(er3, D, X, D1, X1, NULL);
+        if (mpz_odd_p(tp.r0) == 0) {     // D = [r1*(x+1)+r2]
+            cp.pai.scl_mul(D, c, tp.r1);
+        }
+        else {                          // D = [-r1*x+r2]
+            mpz_neg(tp.r1, tp.r1);
+            cp.pai.scl_mul(D, c, tp.r1);
+        }
+        cp.pai.add(D, D, tp.er2);
+        cp.pai.add(X, c, tp.er3);        // X = [x+r3]
+        cp.pdec(D1, D);
+        cp.pdec(X1, X);
+
+        //Step-2
+        mpz_t d, x, D2, X2, et, etx;
+        mpz_inits(d, x, D2, X2, et, etx, NULL);
+        csp.pdec(D2, D);
+        csp.fdec(d, D1, D2);
+        csp.pdec(X2, X);
+        csp.fdec(x, X1, X2);
+
+        if (mpz_cmp(d, csp.pai.pubkey.half_n) > 0) {
+            mpz_set_ui(d, 0);
+            mpz_set_ui(x, 0);
+        }
+        else {
+            mpz_set_ui(d, 1);
+        }
+        csp.pai.encrypt(et, d);         // [t]
+        csp.pai.encrypt(etx, x);        // [t*(x+r3)]
+        traffic(C_FSSBA, cp, 1, 4, 2);
+
+        //Step-3
+        mpz_neg(tp.r3, tp.r3);
+        cp.pai.scl_mul(er3, et, tp.r3);
+        cp.pai.add(etx, etx, er3);      // [t*x]
+        if (mpz_odd_p(tp.r0) == 0) {     // s_x = t, u_x = x-2*t*x
+            mpz_set(s_x, et);
+            cp.pai.scl_mul(etx, etx, neg_two);
+            cp.pai.add(u_x, c, etx);
+        }
+        else {                          // s_x = 1-t, u_x = 2*t*x-x
+            cp.pai.scl_mul(et, et, neg_one);
+            cp.pai.add(s_x, cp.eone, et);
+            cp.pai.add(etx, etx, etx);
+            cp.pai.scl_mul(X, c, neg_one);
+            cp.pai.add(u_x, etx, X);
+        }
+
+        mpz_clears(er3, D, X, D1, X1, NULL);
+        mpz_clears(d, x, D2, X2, et, etx, NULL);
+    }
+
+    /*
+    Batched Fused Secure Sign Bit-Acquisition Protocol.
+    All n instances share one CP->CSP round and run on the worker threads.
+    */
+    void seccomp::fssba(mpz_t *s_x, mpz_t *u_x, mpz_t *c, int n, PaillierThd cp, PaillierThd csp) {
+        parallel_for(n, [&](int i) {
+            fssba_once(s_x[i], u_x[i], c[i], cp, csp);
+        });
+        round(C_FSSBA);
+    }
+
     /*Secure Division Protocol*/
-    void seccomp::sdiv(mpz_t eq, mpz_t er, mpz_t ex, mpz_t ey, int ell, PaillierThd cp, PaillierThd csp, Paillier pai) {
+    void seccomp::sdiv(mpz_t eq, mpz_t er, const mpz_t ex, const mpz_t ey, int ell, PaillierThd cp, PaillierThd csp, Paillier pai) {
         mpz_set(eq, cp.ezero);  
         
         mpz_t c, u, e, ue, m, two;
@@ -181,4 +501,467 @@ namespace soci {
 
         mpz_clears(c, u, e, ue, m, two, NULL);
     }
+
+    /*
+    Secure Division by a Public Constant Protocol.
+    Computes eq = [floor(x/d)] for a public d > 0 and |x| < 2^ell by additive masking.
+    With exact == false the result is floor(x/d) + c, where c = 1 with probability
+    (x mod d)/d (probabilistic rounding), in one CP->CSP round.
+    With exact == true, c is removed with one additional scmp.
+    */
+    void seccomp::sdiv_pub(mpz_t eq, const mpz_t ex, const mpz_t d, int ell, PaillierThd cp, PaillierThd csp, bool exact) {
+        sdiv_pub_once(eq, ex, d, ell, cp, csp, exact);
+        round(C_SDIV_PUB);
+        if (exact) {
+            round(C_SCMP);
+        }
+    }
+
+    /*CP sends Z and its partial decryption, CSP returns [q] and with exact [(x+R) mod d]*/
+    void seccomp::sdiv_pub_once(mpz_t eq, const mpz_t ex, const mpz_t d, int ell, PaillierThd &cp, PaillierThd &csp, bool exact) {
+        // x+R < 2^(ell+|d|+sigma+1) must not wrap around N^s
+        if ((size_t)ell + mpz_sizeinbase(d, 2) + sigma + 1 >= mpz_sizeinbase(cp.pai.pubkey.ns, 2)) {
+            throw("ell + |d| + sigma + 1 must be less than |n^s|");
+        }
+
+        // Step-1
+        mpz_t r, A, B, er, Z, Z1;
+        mpz_inits(r, A, B, er, Z, Z1, NULL);
+        // uniform mask, so that R mod d is (statistically) uniform
+        gmp_rand_mutex.lock();
+        mpz_urandomb(r, gmp_rand, ell + mpz_sizeinbase(d, 2) + sigma);
+        gmp_rand_mutex.unlock();
+        mpz_mul_2exp(A, d, ell);        // offset d*2^ell makes x+R non-negative
+        mpz_add(r, r, A);               // R = d*2^ell + r
+        mpz_fdiv_qr(A, B, r, d);        // R = A*d + B
+        cp.pai.encrypt(er, r);
+        cp.pai.add(Z, ex, er);          // Z = [x+R]
+        cp.pdec(Z1, Z);
+
+        // Step-2
+        mpz_t z, q, Z2, eb;
+        mpz_inits(z, q, Z2, eb, NULL);
+        csp.pdec(Z2, Z);
+        csp.fdec(z, Z1, Z2);
+        mpz_fdiv_qr(q, z, z, d);        // x+R = q*d + z
+        csp.pai.encrypt(eq, q);
+        if (exact) {
+            csp.pai.encrypt(Z, z);      // [(x+R) mod d]
+        }
+        traffic(C_SDIV_PUB, cp, 1, 2, exact ? 2 : 1);
+
+        // Step-3
+        mpz_neg(A, A);
+        mpz_mod(A, A, cp.pai.pubkey.ns);
+        cp.pai.encrypt(er, A);
+        cp.pai.add(eq, eq, er);         // [q-A]
+        if (exact) {
+            cp.pai.encrypt(eb, B);
+            scmp_once(er, Z, eb, cp, csp);  // carry c = [(x+R) mod d < B]
+            cp.pai.scl_mul(er, er, neg_one);
+            cp.pai.add(eq, eq, er);
+        }
+
+        mpz_clears(r, A, B, er, Z, Z1, NULL);
+        mpz_clears(z, q, Z2, eb, NULL);
+    }
+
+    /*
+    Batched Secure Division by a Public Constant Protocol.
+    All n instances share their rounds and run on the worker threads.
+    */
+    void seccomp::sdiv_pub(mpz_t *eq, mpz_t *ex, int n, const mpz_t d, int ell, PaillierThd cp, PaillierThd csp, bool exact) {
+        parallel_for(n, [&](int i) {
+            sdiv_pub_once(eq[i], ex[i], d, ell, cp, csp, exact);
+        });
+        round(C_SDIV_PUB);
+        if (exact) {
+            round(C_SCMP);
+        }
+    }
+
+    /*Secure Truncation Protocol, eq = [floor(x/2^k)]*/
+    void seccomp::strunc(mpz_t eq, const mpz_t ex, int k, int ell, PaillierThd cp, PaillierThd csp, bool exact) {
+        mpz_t d;
+        mpz_init(d);
+        mpz_setbit(d, k);
+        sdiv_pub(eq, ex, d, ell, cp, csp, exact);
+        mpz_clear(d);
+    }
+
+    void seccomp::strunc(mpz_t *eq, mpz_t *ex, int n, int k, int ell, PaillierThd cp, PaillierThd csp, bool exact) {
+        mpz_t d;
+        mpz_init(d);
+        mpz_setbit(d, k);
+        sdiv_pub(eq, ex, n, d, ell, cp, csp, exact);
+        mpz_clear(d);
+    }
+
+    /*
+    Secure Product Protocol, res = [x_0 * x_1 * ... * x_{k-1}].
+    Balanced multiplication tree, every level is one batched smul round,
+    so k values take ceil(log2 k) rounds.
+    */
+    void seccomp::sprod(mpz_t res, mpz_t *ex, int k, PaillierThd cp, PaillierThd csp) {
+        if (k <= 0) {
+            mpz_set(res, cp.eone);
+            return;
+        }
+        mpz_t *cur = new mpz_t[k], *nxt = new mpz_t[k];
+        for (int i = 0; i < k; i++) {
+            mpz_init_set(cur[i], ex[i]);
+            mpz_init(nxt[i]);
+        }
+        for (int m = k; m > 1; m = (m + 1) / 2) {
+            parallel_for(m / 2, [&](int i) {
+                smul_once(nxt[i], cur[2 * i], cur[2 * i + 1], cp, csp);
+            });
+            round(C_SMUL);
+            if (m % 2 == 1) {
+                mpz_set(nxt[m / 2], cur[m - 1]);    // odd one out moves up a level
+            }
+            swap(cur, nxt);
+        }
+        mpz_set(res, cur[0]);
+        for (int i = 0; i < k; i++) {
+            mpz_clears(cur[i], nxt[i], NULL);
+        }
+        delete[] cur;
+        delete[] nxt;
+    }
+
+    /*
+    Secure Power Protocol, res = [x^d].
+    Square-and-multiply where every round squares and multiplies together,
+    floor(log2 d) rounds plus one if d is not a power of two.
+    */
+    void seccomp::spow(mpz_t res, const mpz_t ex, unsigned long d, PaillierThd cp, PaillierThd csp) {
+        if (d == 0) {
+            mpz_set(res, cp.eone);
+            return;
+        }
+        mpz_t p, sq, acc;
+        mpz_inits(p, sq, acc, NULL);
+        mpz_set(p, ex);                 // p = [x^(2^j)]
+        bool have = false;              // acc = [x^(d mod 2^j)] once have is set
+        for (; d > 1; d >>= 1) {
+            bool mul = (d & 1) && have;
+            if ((d & 1) && !have) {
+                mpz_set(acc, p);
+                have = true;
+            }
+            parallel_for(mul ? 2 : 1, [&](int i) {
+                i == 0 ? smul_once(sq, p, p, cp, csp) : smul_once(acc, acc, p, cp, csp);
+            });
+            round(C_SMUL);
+            mpz_swap(p, sq);
+        }
+        if (have) {
+            smul(res, acc, p, cp, csp);
+        }
+        else {
+            mpz_set(res, p);
+        }
+        mpz_clears(p, sq, acc, NULL);
+    }
+
+    /*
+    ep[i] = [x^(i+1)] for 0 <= i < d.
+    Round r computes the powers in (2^(r-1), 2^r] from those below,
+    ceil(log2 d) batched smul rounds.
+    */
+    void seccomp::spowers(mpz_t *ep, const mpz_t ex, int d, PaillierThd cp, PaillierThd csp) {
+        if (d <= 0) {
+            return;
+        }
+        mpz_set(ep[0], ex);
+        for (int h = 1; h < d; h *= 2) {
+            int m = d - h < h ? d - h : h;
+            parallel_for(m, [&](int j) {
+                smul_once(ep[h + j], ep[h - 1], ep[j], cp, csp);    // x^(h+j+1) = x^h * x^(j+1)
+            });
+            round(C_SMUL);
+        }
+    }
+
+    /*
+    Secure Polynomial Evaluation Protocol, res = [a_0 + a_1*x + ... + a_deg*x^deg]
+    for public coefficients a (may be negative). The powers of x come from
+    spowers, i.e., ceil(log2 deg) rounds, the rest is local to CP.
+    */
+    void seccomp::spoly(mpz_t res, const mpz_t ex, mpz_t *a, int deg, PaillierThd cp, PaillierThd csp) {
+        mpz_t a0;
+        mpz_init(a0);
+        mpz_mod(a0, a[0], cp.pai.pubkey.ns);
+        cp.pai.encrypt(res, a0);
+        mpz_clear(a0);
+        if (deg <= 0) {
+            return;
+        }
+        mpz_t *ep = new mpz_t[deg];
+        for (int i = 0; i < deg; i++) {
+            mpz_init(ep[i]);
+        }
+        spowers(ep, ex, deg, cp, csp);
+        parallel_for(deg, [&](int i) {
+            mpz_t ai;
+            mpz_init(ai);
+            mpz_mod(ai, a[i + 1], cp.pai.pubkey.ns);
+            cp.pai.scl_mul(ep[i], ep[i], ai);
+            mpz_clear(ai);
+        });
+        for (int i = 0; i < deg; i++) {
+            cp.pai.add(res, res, ep[i]);
+            mpz_clear(ep[i]);
+        }
+        delete[] ep;
+    }
+
+    /*
+    Batched protocols over CipherVector. The inputs are read through views
+    and every result is written straight into its slot of the output vector,
+    which is resized to the input length.
+    */
+    void seccomp::smul(CipherVector &res, const CipherVector &ex, const CipherVector &ey, PaillierThd cp, PaillierThd csp) {
+        res.resize(ex.size());
+        parallel_for(ex.size(), [&](long i) {
+            mpz_t x, y, z;
+            mpz_init(z);
+            smul_once(z, ex.view(x, i), ey.view(y, i), cp, csp);
+            res.set(i, z);
+            mpz_clear(z);
+        });
+        round(C_SMUL);
+    }
+
+    void seccomp::scmp(CipherVector &res, const CipherVector &ex, const CipherVector &ey, PaillierThd cp, PaillierThd csp) {
+        res.resize(ex.size());
+        parallel_for(ex.size(), [&](long i) {
+            mpz_t x, y, z;
+            mpz_init(z);
+            scmp_once(z, ex.view(x, i), ey.view(y, i), cp, csp);
+            res.set(i, z);
+            mpz_clear(z);
+        });
+        round(C_SCMP);
+    }
+
+    void seccomp::scmp(CipherVector &res, const CipherVector &ex, const mpz_t ey, PaillierThd cp, PaillierThd csp) {
+        res.resize(ex.size());
+        parallel_for(ex.size(), [&](long i) {
+            mpz_t x, z;
+            mpz_init(z);
+            scmp_once(z, ex.view(x, i), ey, cp, csp);
+            res.set(i, z);
+            mpz_clear(z);
+        });
+        round(C_SCMP);
+    }
+
+    void seccomp::scmp(CipherVector &res, const mpz_t ex, const CipherVector &ey, PaillierThd cp, PaillierThd csp) {
+        res.resize(ey.size());
+        parallel_for(ey.size(), [&](long i) {
+            mpz_t y, z;
+            mpz_init(z);
+            scmp_once(z, ex, ey.view(y, i), cp, csp);
+            res.set(i, z);
+            mpz_clear(z);
+        });
+        round(C_SCMP);
+    }
+
+    void seccomp::fssba(CipherVector &s_x, CipherVector &u_x, const CipherVector &c, PaillierThd cp, PaillierThd csp) {
+        s_x.resize(c.size());
+        u_x.resize(c.size());
+        parallel_for(c.size(), [&](long i) {
+            mpz_t x, s, u;
+            mpz_inits(s, u, NULL);
+            fssba_once(s, u, c.view(x, i), cp, csp);
+            s_x.set(i, s);
+            u_x.set(i, u);
+            mpz_clears(s, u, NULL);
+        });
+        round(C_FSSBA);
+    }
+
+    void seccomp::sdiv_pub(CipherVector &eq, const CipherVector &ex, const mpz_t d, int ell, PaillierThd cp, PaillierThd csp, bool exact) {
+        eq.resize(ex.size());
+        parallel_for(ex.size(), [&](long i) {
+            mpz_t x, q;
+            mpz_init(q);
+            sdiv_pub_once(q, ex.view(x, i), d, ell, cp, csp, exact);
+            eq.set(i, q);
+            mpz_clear(q);
+        });
+        round(C_SDIV_PUB);
+        if (exact) {
+            round(C_SCMP);
+        }
+    }
+
+    /*Number of w-bit slots that fit in one plaintext without wrapping mod N^s*/
+    int pack_slots(int w, PaillierKey &pk) {
+        return (mpz_sizeinbase(pk.ns, 2) - 1) / w;
+    }
+
+    /*
+    ep = [sum_j u_j * 2^(w*j)] from the slot ciphertexts eu[0..k), by
+    Horner's rule on the ciphertexts. The plaintexts must be in [0, 2^w).
+    */
+    void pack(mpz_t ep, mpz_t *eu, int k, int w, PaillierThd &cp) {
+        mpz_t shift;
+        mpz_init(shift);
+        mpz_setbit(shift, w);
+        mpz_set(ep, eu[k - 1]);
+        for (int j = k - 2; j >= 0; j--) {
+            cp.pai.scl_mul(ep, ep, shift);
+            cp.pai.add(ep, ep, eu[j]);
+        }
+        mpz_clear(shift);
+    }
+
+    /*
+    Packed Batched Secure Multiplication Protocol, res[i] = [x_i * y_i] for
+    |x_i|, |y_i| < 2^ell.
+    CP masks x_i + R1_i and y_i + R2_i with R of ell+sigma+1 bits and packs
+    the masked pairs into the slots of one plaintext, so CP sends one
+    ciphertext and one partial decryption per pack_slots/2 pairs instead of
+    four values per pair, and CSP runs one partial decryption per pack.
+    CSP still returns one ciphertext per product, because CP needs them
+    as independent ciphertexts. Falls back to smul when a pair does not fit.
+    */
+    void seccomp::smul_packed(mpz_t *res, mpz_t *ex, mpz_t *ey, int n, int ell, PaillierThd cp, PaillierThd csp) {
+        int w = ell + sigma + 2;
+        int per = pack_slots(w, cp.pai.pubkey) / 2;
+        if (per < 1) {
+            smul(res, ex, ey, n, cp, csp);
+            return;
+        }
+        int packs = (n + per - 1) / per;
+        parallel_for(packs, [&](int p) {
+            int lo = p * per, k = n - lo < per ? n - lo : per;
+            mpz_t *R = new mpz_t[2 * k], *eu = new mpz_t[2 * k];
+            mpz_t P, P1, P2, z, u, t;
+            mpz_inits(P, P1, P2, z, u, t, NULL);
+
+            // CP: slots 2j and 2j+1 hold x_j + R1_j and y_j + R2_j
+            for (int j = 0; j < 2 * k; j++) {
+                mpz_inits(R[j], eu[j], NULL);
+                get_secRandNum(R[j], ell + sigma);
+                mpz_setbit(R[j], ell + sigma);          // R >= 2^ell keeps x + R positive
+                cp.pai.scl_mul(eu[j], cp.eone, R[j]);
+                cp.pai.add(eu[j], j % 2 == 0 ? ex[lo + j / 2] : ey[lo + j / 2], eu[j]);
+            }
+            pack(P, eu, 2 * k, w, cp);
+            cp.pdec(P1, P);
+
+            // CSP: unpack and return [(x+R1)(y+R2)]
+            csp.pdec(P2, P);
+            csp.fdec(z, P1, P2);
+            for (int j = 0; j < k; j++) {
+                mpz_fdiv_r_2exp(u, z, w);
+                mpz_fdiv_q_2exp(z, z, w);
+                mpz_fdiv_r_2exp(t, z, w);
+                mpz_fdiv_q_2exp(z, z, w);
+                mpz_mul(u, u, t);
+                mpz_mod(u, u, csp.pai.pubkey.ns);
+                csp.pai.encrypt(res[lo + j], u);
+            }
+
+            // CP: [xy] = [(x+R1)(y+R2)] - [x]^R2 - [y]^R1 - [R1*R2]
+            for (int j = 0; j < k; j++) {
+                mpz_neg(t, R[2 * j + 1]);
+                cp.pai.scl_mul(u, ex[lo + j], t);
+                cp.pai.add(res[lo + j], res[lo + j], u);
+                mpz_neg(t, R[2 * j]);
+                cp.pai.scl_mul(u, ey[lo + j], t);
+                cp.pai.add(res[lo + j], res[lo + j], u);
+                mpz_mul(t, R[2 * j], R[2 * j + 1]);
+                mpz_neg(t, t);
+                cp.pai.scl_mul(u, cp.eone, t);
+                cp.pai.add(res[lo + j], res[lo + j], u);
+            }
+            traffic(C_SMUL_PACKED, cp, k, 2, k);
+
+            for (int j = 0; j < 2 * k; j++) {
+                mpz_clears(R[j], eu[j], NULL);
+            }
+            delete[] R;
+            delete[] eu;
+            mpz_clears(P, P1, P2, z, u, t, NULL);
+        });
+        round(C_SMUL_PACKED);
+    }
+
+    /*
+    Packed Batched Secure Comparison Protocol, res[i] = [x_i < y_i] for
+    |x_i|, |y_i| < 2^ell.
+    Every slot holds r1*(x-y+1) - r0 or r1*(y-x) - r0 (by the parity of r0,
+    as in scmp) offset by 2^(w-1), so CSP reads the sign from the slot.
+    CP sends one ciphertext and one partial decryption per pack_slots
+    comparisons instead of two values per comparison. Falls back to scmp
+    when a slot does not fit.
+    */
+    void seccomp::scmp_packed(mpz_t *res, mpz_t *ex, mpz_t *ey, int n, int ell, PaillierThd cp, PaillierThd csp) {
+        int w = ell + 2 * sigma + 4;
+        int per = pack_slots(w, cp.pai.pubkey);
+        if (per < 1) {
+            scmp(res, ex, ey, n, cp, csp);
+            return;
+        }
+        int packs = (n + per - 1) / per;
+        parallel_for(packs, [&](int p) {
+            int lo = p * per, k = n - lo < per ? n - lo : per;
+            mpz_t *r0 = new mpz_t[k], *eu = new mpz_t[k];
+            mpz_t P, P1, P2, z, u, r1, off;
+            mpz_inits(P, P1, P2, z, u, r1, off, NULL);
+            mpz_setbit(off, w - 1);
+
+            // CP: slot j = r1*(x-y+1) - r0 + 2^(w-1) if r0 is even, r1*(y-x) - r0 + 2^(w-1) otherwise
+            for (int j = 0; j < k; j++) {
+                mpz_inits(r0[j], eu[j], NULL);
+                get_secRandNum(r0[j], sigma);
+                get_secRandNum(r1, sigma + sigma);
+                bool even = mpz_odd_p(r0[j]) == 0;
+                cp.pai.scl_mul(eu[j], even ? ex[lo + j] : ey[lo + j], r1);
+                mpz_neg(u, r1);
+                cp.pai.scl_mul(P, even ? ey[lo + j] : ex[lo + j], u);
+                cp.pai.add(eu[j], eu[j], P);
+                mpz_sub(u, off, r0[j]);
+                if (even) {
+                    mpz_add(u, u, r1);
+                }
+                cp.pai.scl_mul(P, cp.eone, u);
+                cp.pai.add(eu[j], eu[j], P);
+            }
+            pack(P, eu, k, w, cp);
+            cp.pdec(P1, P);
+
+            // CSP: t_j = [slot_j <= 2^(w-1)]
+            csp.pdec(P2, P);
+            csp.fdec(z, P1, P2);
+            for (int j = 0; j < k; j++) {
+                mpz_fdiv_r_2exp(u, z, w);
+                mpz_fdiv_q_2exp(z, z, w);
+                mpz_set(res[lo + j], mpz_cmp(u, off) > 0 ? csp.ezero : csp.eone);
+            }
+
+            // CP: flip the odd ones
+            for (int j = 0; j < k; j++) {
+                if (mpz_odd_p(r0[j]) != 0) {
+                    cp.pai.scl_mul(res[lo + j], res[lo + j], neg_one);
+                    cp.pai.add(res[lo + j], cp.eone, res[lo + j]);
+                }
+            }
+            traffic(C_SCMP_PACKED, cp, k, 2, k);
+
+            for (int j = 0; j < k; j++) {
+                mpz_clears(r0[j], eu[j], NULL);
+            }
+            delete[] r0;
+            delete[] eu;
+            mpz_clears(P, P1, P2, z, u, r1, off, NULL);
+        });
+        round(C_SCMP_PACKED);
+    }
 }
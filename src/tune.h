@@ -0,0 +1,123 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <mutex>
+#include <atomic>
+#include "gmp.h"
+#include "paillier.h"
+#include "parallel.h"
+
+using namespace phe;
+using namespace std;
+
+namespace soci {
+
+    /*
+    Per-machine performance parameters, chosen by tune() (see autotune.h)
+    and loaded lazily by tuned(). The key length and sigma are security
+    parameters and are never tuned.
+    */
+    class tune_config {
+
+    public:
+        int key_bits = 0;           // key length the kernels were timed with, 0 if never tuned
+        int threads = 0;            // worker threads of parallel_for, 0 means one per hardware core
+        int chunk = 1024;           // ciphertexts per batched round (pscan, sorted_index)
+        int batch = 256;            // values per ingest batch, derived from chunk / threads
+        int fb_window = 4;          // window width of the fbcache tables
+        int nn_window = 4;          // window width of the Straus tables in nn::dense
+    };
+
+    /*Path of the configuration file, $SOCI_TUNE_FILE or ./soci.conf*/
+    const char *tune_file() {
+        const char *path = getenv("SOCI_TUNE_FILE");
+        return path != NULL && path[0] != '\0' ? path : "soci.conf";
+    }
+
+    /*The file holds one "name value" pair per line, unknown names are ignored*/
+    bool save_tune(const char *path, tune_config &cfg) {
+        FILE *fp = fopen(path, "w");
+        if (fp == NULL) {
+            return false;
+        }
+        fprintf(fp, "key_bits %d\n", cfg.key_bits);
+        fprintf(fp, "threads %d\n", cfg.threads);
+        fprintf(fp, "chunk %d\n", cfg.chunk);
+        fprintf(fp, "batch %d\n", cfg.batch);
+        fprintf(fp, "fb_window %d\n", cfg.fb_window);
+        fprintf(fp, "nn_window %d\n", cfg.nn_window);
+        fclose(fp);
+        return true;
+    }
+
+    bool load_tune(const char *path, tune_config &cfg) {
+        FILE *fp = fopen(path, "r");
+        if (fp == NULL) {
+            return false;
+        }
+        char name[64];
+        double v;
+        while (fscanf(fp, "%63s %lf", name, &v) == 2) {
+            if (strcmp(name, "key_bits") == 0) cfg.key_bits = (int)v;
+            else if (strcmp(name, "threads") == 0) cfg.threads = v >= 0 ? (int)v : 0;
+            else if (strcmp(name, "chunk") == 0) cfg.chunk = v >= 1 ? (int)v : cfg.chunk;
+            else if (strcmp(name, "batch") == 0) cfg.batch = v >= 1 ? (int)v : cfg.batch;
+            else if (strcmp(name, "fb_window") == 0) cfg.fb_window = v >= 1 && v <= 16 ? (int)v : cfg.fb_window;
+            else if (strcmp(name, "nn_window") == 0) cfg.nn_window = v >= 1 && v <= 16 ? (int)v : cfg.nn_window;
+        }
+        fclose(fp);
+        return true;
+    }
+
+    /*Configuration of this process, read from tune_file() on first use*/
+    tune_config &tuned() {
+        static tune_config cfg;
+        static once_flag loaded;
+        call_once(loaded, [] { load_tune(tune_file(), cfg); });
+        return cfg;
+    }
+
+    /*Bits of each prime of pk, the length passed to keygen and recorded as key_bits*/
+    int key_bits(const PaillierKey &pk) {
+        return (int)(mpz_sizeinbase(pk.n, 2) + 1) / 2;
+    }
+
+    /*
+    Configuration for operators on the key pk. The timed entries depend on
+    the key length, so a file tuned with another length is still used but
+    a warning goes to stderr once.
+    */
+    tune_config &tuned(const PaillierKey &pk) {
+        static atomic_flag warned = ATOMIC_FLAG_INIT;
+        tune_config &cfg = tuned();
+        int bits = key_bits(pk);
+        if (cfg.key_bits != 0 && cfg.key_bits != bits && !warned.test_and_set()) {
+            fprintf(stderr, "warning: %s was tuned for %d-bit keys, not %d, run soci tune %d\n",
+                tune_file(), cfg.key_bits, bits, bits);
+        }
+        return cfg;
+    }
+
+    int tuned_threads() {
+        return tuned().threads;
+    }
+
+    const bool tuned_threads_installed = (set_thread_source(tuned_threads), true);
+
+    /*Average time of f() in us, repeated for at least min_ms*/
+    template <class F>
+    double time_us(F f, int min_ms = 100) {
+        auto start = chrono::steady_clock::now();
+        long reps = 0;
+        double us;
+        do {
+            f();
+            reps++;
+            us = chrono::duration<double, micro>(chrono::steady_clock::now() - start).count();
+        } while (us < min_ms * 1000.0);
+        return us / reps;
+    }
+}
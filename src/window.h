@@ -0,0 +1,268 @@
+#pragma once
+
+#include <vector>
+#include "gmp.h"
+#include "paillier.h"
+#include "soci.h"
+
+using namespace phe;
+using namespace std;
+
+namespace soci {
+
+    /*Aggregates maintained by a sliding window, or-ed together*/
+    enum window_agg { W_SUM = 1, W_AVG = 2, W_MIN = 4, W_MAX = 8 };
+
+    /*Aggregates of the current window, count is public*/
+    class window_result {
+
+    public:
+        mpz_t sum, avg, min, max;
+        long count = 0;
+
+        window_result() {
+            mpz_inits(this->sum, this->avg, this->min, this->max, NULL);
+        }
+
+        window_result(const window_result &) = delete;
+        window_result& operator=(const window_result &) = delete;
+
+        ~window_result() {
+            mpz_clears(this->sum, this->avg, this->min, this->max, NULL);
+        }
+    };
+
+    /*
+    Incremental SUM, AVG, MIN and MAX over a sliding window of an encrypted
+    stream, held by CP. The window holds the last size arrivals (count
+    window) or the arrivals with ts > now - size (time window). Timestamps
+    are public and must not decrease over the life of the window, even
+    across clear(); a new stream needs a new window.
+
+    SUM adds each arrival and subtracts each evicted item, AVG divides it by
+    the public count with sdiv_pub (the sum must be in [0, 2^ell)).
+    MIN and MAX use a two-stack queue: the back stack keeps the running
+    min/max of its items, the front stack the min/max of every suffix, and
+    the back is moved onto the front when the front runs empty. A monotonic
+    deque is not used because its pops depend on the comparison results.
+    Every combine step is one batched scmp round and one batched smul round
+    for MIN and MAX together, about three steps per arrival amortized.
+    Values compared must be less than half_n in absolute value.
+    */
+    class sliding_window {
+
+    public:
+        PaillierThd cp, csp;
+        seccomp sc;
+        long size;
+        bool by_time;
+        int aggs, ell;
+
+        sliding_window(PaillierThd cp, PaillierThd csp, long size, bool by_time = false, int aggs = W_SUM | W_MIN | W_MAX, int ell = 32)
+            : cp(cp), csp(csp), size(size), by_time(by_time), aggs(aggs), ell(ell) {
+            if (size < 1) {
+                throw("window size must be positive");
+            }
+            mpz_inits(this->esum, this->bmin, this->bmax, NULL);
+            mpz_set(this->esum, cp.ezero);
+        }
+
+        sliding_window(const sliding_window &) = delete;
+        sliding_window& operator=(const sliding_window &) = delete;
+
+        ~sliding_window() {
+            clear();
+            mpz_clears(esum, bmin, bmax, NULL);
+        }
+
+        long count() { return front.size() + back.size(); }
+        void push(const mpz_t ex, long ts = 0);
+        void emit(window_result &out);
+        void advance(window_result *out, mpz_t *ex, long *ts, int n);
+        void clear();
+
+    private:
+        /*Stream element, min/max are the suffix aggregates while it is on the front stack*/
+        class item {
+
+        public:
+            mpz_t v, min, max;
+            long ts;
+
+            item(const mpz_t v, long ts) : ts(ts) {
+                mpz_init_set(this->v, v);
+                mpz_inits(this->min, this->max, NULL);
+            }
+
+            ~item() {
+                mpz_clears(this->v, this->min, this->max, NULL);
+            }
+        };
+
+        vector<item *> front, back;     // front.back() is the oldest item, back.back() the newest
+        mpz_t esum, bmin, bmax;         // [SUM] of the window, [MIN] and [MAX] of the back stack
+        long now = 0;                   // timestamp of the last arrival
+        bool stamped = false;           // now is set, kept by clear()
+
+        bool minmax() { return (aggs & (W_MIN | W_MAX)) != 0; }
+        void combine(mpz_t *emin, mpz_t *emax, const mpz_t amin, const mpz_t bmin, const mpz_t amax, const mpz_t bmax);
+        void evict();
+        void flip();
+    };
+
+    /*
+    emin = [min(a, b)] and emax = [max(a', b')] in one scmp round and one smul
+    round. Either output may be NULL, then its comparison is skipped.
+    */
+    void sliding_window::combine(mpz_t *emin, mpz_t *emax, const mpz_t amin, const mpz_t bmin, const mpz_t amax, const mpz_t bmax) {
+        mpz_t c[2], d[2], av[2], bv[2];     // av, bv are views
+        mpz_inits(c[0], c[1], d[0], d[1], NULL);
+        const mpz_srcptr a[2] = { amin, amax }, b[2] = { bmin, bmax };
+        mpz_t *out[2] = { emin, emax };
+        int idx[2], n = 0;
+        for (int k = 0; k < 2; k++) {
+            if (out[k] != NULL) {
+                idx[n++] = k;
+            }
+        }
+        parallel_for(n, [&](int t) {
+            int k = idx[t];
+            view_of(av[t], a[k]);
+            view_of(bv[t], b[k]);
+            cp.pai.scl_mul(d[t], b[k], sc.neg_one);
+            cp.pai.add(d[t], a[k], d[t]);                      // [a - b]
+        });
+        sc.scmp(c, av, bv, n, cp, csp);                        // [a < b]
+        sc.smul(d, c, d, n, cp, csp);                          // [(a < b) * (a - b)]
+        parallel_for(n, [&](int t) {
+            int k = idx[t];
+            if (k == 0) {
+                cp.pai.add(*out[k], b[k], d[t]);               // min = b + (a < b)(a - b)
+            }
+            else {
+                cp.pai.scl_mul(d[t], d[t], sc.neg_one);
+                cp.pai.add(*out[k], a[k], d[t]);               // max = a - (a < b)(a - b)
+            }
+        });
+        mpz_clears(c[0], c[1], d[0], d[1], NULL);
+    }
+
+    /*Move the back stack onto the front, computing the suffix min/max from the newest item down*/
+    void sliding_window::flip() {
+        while (!back.empty()) {
+            item *it = back.back();
+            back.pop_back();
+            if (minmax() && front.empty()) {
+                mpz_set(it->min, it->v);
+                mpz_set(it->max, it->v);
+            }
+            else if (minmax()) {
+                item *nx = front.back();
+                combine((aggs & W_MIN) ? &it->min : NULL, (aggs & W_MAX) ? &it->max : NULL,
+                    it->v, nx->min, it->v, nx->max);
+            }
+            front.push_back(it);
+        }
+    }
+
+    /*Drop the items that left the window*/
+    void sliding_window::evict() {
+        while (count() > 0) {
+            if (front.empty()) {
+                flip();
+            }
+            item *it = front.back();
+            if (by_time ? it->ts > now - size : count() <= size) {
+                break;
+            }
+            if (aggs & (W_SUM | W_AVG)) {
+                mpz_t neg;
+                mpz_init(neg);
+                cp.pai.scl_mul(neg, it->v, sc.neg_one);
+                cp.pai.add(esum, esum, neg);
+                mpz_clear(neg);
+            }
+            front.pop_back();
+            delete it;
+        }
+    }
+
+    /*Append one arrival and evict what no longer fits*/
+    void sliding_window::push(const mpz_t ex, long ts) {
+        if (by_time && stamped && ts < now) {
+            throw("timestamps must not decrease");
+        }
+        now = ts;
+        stamped = true;
+        if (aggs & (W_SUM | W_AVG)) {
+            cp.pai.add(esum, esum, ex);
+        }
+        if (minmax()) {
+            if (back.empty()) {
+                mpz_set(bmin, ex);
+                mpz_set(bmax, ex);
+            }
+            else {
+                combine((aggs & W_MIN) ? &bmin : NULL, (aggs & W_MAX) ? &bmax : NULL, ex, bmin, ex, bmax);
+            }
+        }
+        back.push_back(new item(ex, ts));
+        evict();
+    }
+
+    /*
+    Aggregates of the current window. min and max are [0] for an empty
+    window. avg costs one sdiv_pub, the rest at most one combine step.
+    */
+    void sliding_window::emit(window_result &out) {
+        out.count = count();
+        mpz_set(out.sum, esum);
+        if ((aggs & W_AVG) && out.count > 0) {
+            mpz_t d;
+            mpz_init_set_si(d, out.count);
+            sc.sdiv_pub(out.avg, esum, d, ell, cp, csp);
+            mpz_clear(d);
+        }
+        else {
+            mpz_set(out.avg, cp.ezero);
+        }
+        if (!minmax() || out.count == 0) {
+            mpz_set(out.min, cp.ezero);
+            mpz_set(out.max, cp.ezero);
+        }
+        else if (back.empty()) {
+            mpz_set(out.min, front.back()->min);
+            mpz_set(out.max, front.back()->max);
+        }
+        else if (front.empty()) {
+            mpz_set(out.min, bmin);
+            mpz_set(out.max, bmax);
+        }
+        else {
+            item *old = front.back();
+            combine((aggs & W_MIN) ? &out.min : NULL, (aggs & W_MAX) ? &out.max : NULL,
+                old->min, bmin, old->max, bmax);
+        }
+    }
+
+    /*Push n arrivals and emit the window after each one, ts may be NULL for count windows*/
+    void sliding_window::advance(window_result *out, mpz_t *ex, long *ts, int n) {
+        for (int i = 0; i < n; i++) {
+            push(ex[i], ts != NULL ? ts[i] : 0);
+            emit(out[i]);
+        }
+    }
+
+    /*Empty the window, the last timestamp is kept*/
+    void sliding_window::clear() {
+        for (item *it : front) {
+            delete it;
+        }
+        for (item *it : back) {
+            delete it;
+        }
+        front.clear();
+        back.clear();
+        mpz_set(esum, cp.ezero);
+    }
+}